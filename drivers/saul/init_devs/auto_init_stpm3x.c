@@ -13,7 +13,7 @@
  *
  * @}
  */
-#ifdef MODULE_STPM3X
+#ifdef MODULE_STPM3X_SAUL
 #include "assert.h"
 #include "log.h"
 #include "saul_reg.h"
@@ -25,10 +25,15 @@
  */
 static stpm3x_t stpm3x_devs[STPM3X_NUMOF];
 
+/**
+ * @brief   Number of SAUL entries per device: one per phase, then the line
+ */
+#define STPM3X_SAUL_NUMOF  (STPM3X_CHANNELS + 1)
+
 /**
  * @brief   Memory for the SAUL registry entries
  */
-static saul_reg_t saul_entries[STPM3X_NUMOF * 4];
+static saul_reg_t saul_entries[STPM3X_NUMOF * STPM3X_SAUL_NUMOF];
 
 /**
  * @brief   Define the number of saul info
@@ -39,10 +44,11 @@ static saul_reg_t saul_entries[STPM3X_NUMOF * 4];
  * @brief   Reference the driver structs.
  * @{
  */
-extern const saul_driver_t stpm3x_current1_saul_driver;
-extern const saul_driver_t stpm3x_voltage1_saul_driver;
-extern const saul_driver_t stpm3x_current2_saul_driver;
-extern const saul_driver_t stpm3x_voltage2_saul_driver;
+extern const saul_driver_t stpm3x_phase1_saul_driver;
+#ifdef MODULE_STPM3X_CH2
+extern const saul_driver_t stpm3x_phase2_saul_driver;
+#endif
+extern const saul_driver_t stpm3x_line_saul_driver;
 /** @} */
 
 void auto_init_stpm3x(void)
@@ -55,29 +61,26 @@ void auto_init_stpm3x(void)
             LOG_ERROR("[auto_init_saul] error initializing stpm3x #%u\n", i);
             continue;
         }
-        /* current 1 */
-        saul_entries[(i * 4)].dev = &(stpm3x_devs[i]);
-        saul_entries[(i * 4)].name = stpm3x_saul_info[i].name;
-        saul_entries[(i * 4)].driver = &stpm3x_current1_saul_driver;
-        /* voltage 1 */
-        saul_entries[(i * 4) + 1].dev = &(stpm3x_devs[i]);
-        saul_entries[(i * 4) + 1].name = stpm3x_saul_info[i].name;
-        saul_entries[(i * 4) + 1].driver = &stpm3x_voltage1_saul_driver;
-        /* current 2 */
-        saul_entries[(i * 4) + 2].dev = &(stpm3x_devs[i]);
-        saul_entries[(i * 4) + 2].name = stpm3x_saul_info[i].name;
-        saul_entries[(i * 4) + 2].driver = &stpm3x_current2_saul_driver;
-        /* voltage 2 */
-        saul_entries[(i * 4) + 3].dev = &(stpm3x_devs[i]);
-        saul_entries[(i * 4) + 3].name = stpm3x_saul_info[i].name;
-        saul_entries[(i * 4) + 3].driver = &stpm3x_voltage2_saul_driver;
+        saul_reg_t *entries = &saul_entries[i * STPM3X_SAUL_NUMOF];
+        /* phase 1: voltage, current, active power */
+        entries[0].driver = &stpm3x_phase1_saul_driver;
+#ifdef MODULE_STPM3X_CH2
+        /* phase 2: voltage, current, active power */
+        entries[1].driver = &stpm3x_phase2_saul_driver;
+#endif
+        /* line: period, frequency, power factor */
+        entries[STPM3X_SAUL_NUMOF - 1].driver = &stpm3x_line_saul_driver;
         /* register to saul */
-        saul_reg_add(&(saul_entries[(i * 4)]));
-        saul_reg_add(&(saul_entries[(i * 4) + 1]));
-        saul_reg_add(&(saul_entries[(i * 4) + 2]));
-        saul_reg_add(&(saul_entries[(i * 4) + 3]));
+        for (unsigned j = 0; j < STPM3X_SAUL_NUMOF; j++) {
+            entries[j].dev = &(stpm3x_devs[i]);
+            entries[j].name = stpm3x_saul_info[i].name;
+            saul_reg_add(&entries[j]);
+        }
     }
+#ifdef MODULE_SHELL
+    stpm3x_shell_init(stpm3x_devs, STPM3X_NUMOF);
+#endif
 }
 #else
 typedef int dont_be_pedantic;
-#endif /* MODULE_STPM3X */
+#endif /* MODULE_STPM3X_SAUL */
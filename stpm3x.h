@@ -34,6 +34,30 @@
  * This allows initialisation with the default parameters in `STPM3X_PARAMS_DEFAULT`
  * from "stpm3x_params.h". If you need other settings, you can specify them in the "board.h" file of your board.
  *
+ * Optional features are pseudo-modules. When none of them is selected, all are
+ * pulled in; selecting some of them strips the code, tables and per-device
+ * state of the others:
+ *
+ * ```make
+ * # channel 1 RMS values and SAUL only
+ * USEMODULE += stpm3x stpm3x_saul
+ * ```
+ *
+ * | Pseudo-module   | Feature                                                  |
+ * |-----------------|----------------------------------------------------------|
+ * | stpm3x_ch2      | Channel 2 (otherwise its values read as 0)               |
+ * | stpm3x_power    | Active power (otherwise it reads as 0)                   |
+ * | stpm3x_energy   | Chip-side energy and Ah accumulation (acc_*, ah_*)       |
+ * | stpm3x_wave     | Waveform capture and harmonic analysis                   |
+ * | stpm3x_irq      | INT1/INT2 events: power quality recorder, poll wake-ups  |
+ * | stpm3x_saul     | SAUL entries                                             |
+ * | stpm3x_calib    | Calibration records, loaded from MTD at initialization   |
+ *
+ * The stpm3x_trace pseudo-module, a frame recorder, is only built when listed.
+ *
+ * Timestamps and delays use ztimer when the application uses `ztimer_usec`,
+ * xtimer otherwise.
+ *
  * @{
  * @file
  * @brief       Device driver interface for the STPM3X sensors (STPM32, STPM33, STPM34) from ST.
@@ -41,7 +65,7 @@
  * @details     This device driver allows to read intanteaneous current and voltage values on channels 1&2 given by a STPM3X.
  *              The latch of theses values is automatically done (S/W Auto-latch, DSP_REG3 - bit23)
  *              If you need other physical values which the STPM3X can measure, you need to implement the corresponding function.
- *              The device driver implements communication with the microcontroller only with SPI. For UART, you'll need to implement it.
+ *              The device driver talks to the microcontroller through SPI, or through UART with the stpm3x_transport_uart transport.
  *
  * @author      Joël Carron <jo.carron@cartondu.ch>
  */
@@ -54,10 +78,34 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
 
 #include "board.h"
+#include "kernel_defines.h"
 #include "periph/spi.h"
 #include "periph/gpio.h"
+#ifdef MODULE_PERIPH_UART
+#include "periph/uart.h"
+#endif
+#include "msg.h"
+#include "mutex.h"
+#include "sched.h"
+#include "thread.h"
+
+#ifdef MODULE_MTD
+#include "mtd.h"
+#endif
+
+/**
+ * @brief Number of channels compiled in, see the stpm3x_ch2 pseudo-module
+ */
+#if IS_USED(MODULE_STPM3X_CH2)
+#define STPM3X_CHANNELS                 (2U)
+#else
+#define STPM3X_CHANNELS                 (1U)
+#endif
 
 /**
   * @brief Error codes
@@ -65,15 +113,39 @@ extern "C" {
 enum {
     STPM3X_OK      =     0,           /**< all went as expected */
     STPM3X_ERROR   =    -1,           /**< generic error code */
-    STPM3X_ERROR_GPIO = -2            /**< error code for GPIO */
+    STPM3X_ERROR_GPIO = -2,           /**< error code for GPIO */
+    STPM3X_ERROR_CRC  = -3            /**< bad CRC on a frame received from the device */
  };
 
+/**
+ * @brief Frame exchange operations of a bus, see stpm3x_transport_spi
+ */
+typedef struct stpm3x_transport stpm3x_transport_t;
+
+/**
+ * @brief Frame trace, see stpm3x_trace_init()
+ */
+typedef struct stpm3x_trace stpm3x_trace_t;
+
 /**
  * @brief Parameters for the STPM3X sensor
  */
 typedef struct {
+    const stpm3x_transport_t *transport; /**< Bus to the device, NULL for SPI */
     spi_t spi;                      /**< SPI bus */
     spi_clk_t sclk;                 /**< SPI clock */
+#ifdef MODULE_PERIPH_UART
+    uart_t uart;                    /**< UART, used by stpm3x_transport_uart */
+    uint32_t baudrate;              /**< Highest baud rate negotiated, 0 for STPM3X_UART_BAUD_MAX */
+#endif
+#if IS_USED(MODULE_STPM3X_TRACE) || defined(DOXYGEN)
+    stpm3x_trace_t *trace;          /**< Trace recording the frames, or replayed by stpm3x_transport_replay, may be NULL */
+    uint8_t trace_id;               /**< Id of the device in the trace */
+#endif
+#if (IS_USED(MODULE_STPM3X_CALIB) && defined(MODULE_MTD)) || defined(DOXYGEN)
+    mtd_dev_t *calib_mtd;           /**< MTD holding the calibration record, NULL to keep the reset values */
+    uint32_t calib_addr;            /**< Address of the calibration record */
+#endif
     gpio_t scs;                     /**< Chip-select SPI/UART */
     gpio_t syn;                     /**< Synchronization pin */
     gpio_t int1;                    /**< Interrupt 1 */
@@ -81,14 +153,174 @@ typedef struct {
     gpio_t en;                      /**< Enable pin */
     double currentRMSLSBValue;      /**< From formual p.52 Datasheet */
     double voltageRMSLSBValue;      /**< From formual p.52 Datasheet */
+    double powerLSBValue;           /**< From formual p.52 Datasheet */
+    double energyLSBValue;          /**< Active energy LSB in [mWh], from formual p.52 Datasheet */
+    double chargeLSBValue;          /**< AH_ACC LSB in [mAh] */
     uint32_t gain;                  /**< From Table 14 p.49 of Datasheet */
 } stpm3x_params_t;
 
+/**
+ * @brief Index of the registers captured in a snapshot
+ */
+enum {
+    STPM3X_SNAP_PERIOD = 0,         /**< DSP_REG1: PH1 & PH2 period */
+    STPM3X_SNAP_RMS1,               /**< DSP_REG14: V1 & C1 RMS data */
+    STPM3X_SNAP_RMS2,               /**< DSP_REG15: V2 & C2 RMS data */
+    STPM3X_SNAP_PHASE1,             /**< DSP_REG17: C1 phase / SWC1 time */
+    STPM3X_SNAP_PHASE2,             /**< DSP_REG19: C2 phase / SWC2 time */
+    STPM3X_SNAP_POWER1,             /**< PH1_REG5: PH1 active power */
+    STPM3X_SNAP_POWER2,             /**< PH2_REG5: PH2 active power */
+    STPM3X_SNAP_NUMOF               /**< number of registers in a snapshot */
+};
+
+/**
+ * @brief Raw registers of the STPM3X taken from one S/W latch
+ */
+typedef struct {
+    uint32_t reg[STPM3X_SNAP_NUMOF];  /**< raw register values, see STPM3X_SNAP_* */
+    uint32_t time;                  /**< time of the S/W latch in [us] */
+    uint8_t ranging;                /**< bit i set if the gain of channel i + 1 switched less than STPM3X_GAIN_SETTLE_US before */
+} stpm3x_snapshot_t;
+
+/**
+ * @brief LSB values of the measurements in integer nano-units
+ *
+ * Computed by stpm3x_init() from the LSB values of the parameters,
+ * so that conversions do not need floating point. The current channel
+ * values are rescaled by stpm3x_set_gain().
+ */
+typedef struct {
+    uint32_t voltage;               /**< RMS voltage LSB in [nV] */
+    uint32_t current[STPM3X_CHANNELS]; /**< RMS current LSB of channel 1/2 in [nA] */
+#if IS_USED(MODULE_STPM3X_POWER) || defined(DOXYGEN)
+    uint32_t power[STPM3X_CHANNELS];   /**< Active power LSB of channel 1/2 in [nW] */
+#endif
+#if IS_USED(MODULE_STPM3X_ENERGY) || defined(DOXYGEN)
+    uint32_t energy[STPM3X_CHANNELS];  /**< Active energy LSB of channel 1/2 in [pWh] */
+    uint32_t charge[STPM3X_CHANNELS];  /**< Ampere-hour accumulator LSB of channel 1/2 in [pAh] */
+#endif
+} stpm3x_lsb_t;
+
+/**
+ * @brief Full resolution measurements of both channels
+ */
+typedef struct {
+    int32_t voltage[2];             /**< RMS voltage of channel 1/2 in [uV] */
+    int32_t current[2];             /**< RMS current of channel 1/2 in [uA] */
+    int32_t power[2];               /**< Active power of channel 1/2 in [mW] */
+    uint32_t period[2];             /**< Line period of channel 1/2 in [us] */
+    uint32_t time;                  /**< time of the S/W latch in [us] */
+    uint8_t ranging;                /**< bit i set if channel i + 1 straddles a gain switch, see stpm3x_snapshot_t */
+} stpm3x_measure_t;
+
+/**
+ * @brief Line frequency, phase angle and power factor of both channels
+ */
+typedef struct {
+    uint32_t frequency[2];          /**< Line frequency of channel 1/2 in [mHz] */
+    int32_t angle[2];               /**< Lag of the current on the voltage of channel 1/2 in [mdeg], -180000 to 180000 */
+    int16_t pf[2];                  /**< Power factor of channel 1/2, cosine of the angle in [1/1000] */
+} stpm3x_line_t;
+
+/**
+ * @brief Latest RMS and active power registers, readable from any context
+ */
+typedef struct {
+    uint32_t rms[2];                /**< DSP_REG14/15: V & C RMS data of channel 1/2 */
+    uint32_t power[2];              /**< PH1/PH2_REG5: active power of channel 1/2 */
+} stpm3x_live_t;
+
+/**
+ * @brief Double buffer of stpm3x_live_t guarded by a sequence counter
+ *
+ * The buffer with index `seq & 1` holds the values of the latest snapshot.
+ * The writer fills the other buffer before incrementing @ref seq, so a reader
+ * never waits for the writer, even when it interrupts it.
+ */
+typedef struct {
+    volatile uint32_t seq;          /**< number of snapshots published */
+    stpm3x_live_t buf[2];           /**< published values */
+} stpm3x_live_pub_t;
+
+/**
+ * @brief SPI link quality, see stpm3x_link_train()
+ */
+typedef struct {
+    uint8_t clk;                    /**< index of the SPI clock in use, UINT8_MAX if not managed */
+    uint16_t frames;                /**< frames received in the current window */
+    uint16_t errors;                /**< CRC errors in the current window */
+    uint32_t total_errors;          /**< CRC errors since the initialization */
+    uint32_t total_frames;          /**< frames sent or received since the initialization */
+} stpm3x_link_t;
+
+#ifdef MODULE_PERIPH_UART
+/**
+ * @brief Reception state of the UART transport
+ */
+typedef struct {
+    mutex_t bus;                    /**< serializes the bursts on the UART */
+    mutex_t done;                   /**< unlocked by the RX callback when all expected bytes arrived */
+    uint8_t *buf;                   /**< destination of the received bytes, NULL when nothing is expected */
+    volatile uint16_t len;          /**< bytes received */
+    uint16_t want;                  /**< bytes expected */
+    uint32_t baudrate;              /**< baud rate in use */
+} stpm3x_uart_rx_t;
+#endif
+
+/**
+ * @brief Running statistics of the intervals between timestamps, see stpm3x_jitter_add()
+ *
+ * The sums hold the deviations from the first interval rather than the
+ * intervals themselves, so they stay small for a steady sampler.
+ */
+typedef struct {
+    uint32_t samples;               /**< timestamps added */
+    uint32_t last;                  /**< last timestamp in [us] */
+    uint32_t first;                 /**< first interval in [us] */
+    uint32_t min;                   /**< shortest interval in [us] */
+    uint32_t max;                   /**< longest interval in [us] */
+    int64_t sum;                    /**< sum of the deviations from the first interval in [us] */
+    uint64_t sum_sq;                /**< sum of their squares in [us^2], saturated */
+} stpm3x_jitter_t;
+
+/**
+ * @brief Statistics of the intervals between timestamps
+ */
+typedef struct {
+    uint32_t count;                 /**< number of intervals */
+    uint32_t mean;                  /**< mean interval in [us] */
+    uint32_t min;                   /**< shortest interval in [us] */
+    uint32_t max;                   /**< longest interval in [us] */
+    uint32_t stddev;                /**< standard deviation of the intervals in [us], the jitter */
+} stpm3x_jitter_stats_t;
+
+/**
+ * @brief Number of configuration registers mirrored in RAM, DSP_CR1 (0x00) to US_REG3 (0x28)
+ */
+#define STPM3X_SHADOW_NUMOF             (21U)
+
 /**
  * @brief Device descriptor for the STPM3X sensor
  */
 typedef struct {
     stpm3x_params_t params;         /**< STPM3X initialization parameters */
+    const stpm3x_transport_t *transport; /**< bus to the device */
+#ifdef MODULE_PERIPH_UART
+    stpm3x_uart_rx_t uart;          /**< UART transport state */
+#endif
+    stpm3x_lsb_t lsb;               /**< LSB values computed from the parameters */
+    mutex_t lock;                   /**< serializes latch + read sequences on the device */
+    uint32_t snap_gen;              /**< number of snapshots read so far */
+    uint32_t snap_begin;            /**< time before the latch of the last snapshot was sent in [us] */
+    uint8_t snap_res;               /**< result of the read of the last snapshot */
+    stpm3x_snapshot_t snap;         /**< last snapshot read, shared with waiting readers */
+    stpm3x_jitter_t jitter;         /**< intervals between the snapshots latched */
+    stpm3x_live_pub_t live;         /**< values of the last snapshot for lock-free readers */
+    uint32_t shadow[STPM3X_SHADOW_NUMOF]; /**< last values written to the configuration registers */
+    uint8_t gain[STPM3X_CHANNELS];  /**< current channel gain of channel 1/2 */
+    uint8_t ranging;                /**< channels whose gain switched less than STPM3X_GAIN_SETTLE_US ago */
+    uint32_t gain_time[STPM3X_CHANNELS]; /**< time of the last gain switch of channel 1/2 in [us] */
+    stpm3x_link_t link;             /**< SPI link quality */
 } stpm3x_t;
 
 /**
@@ -105,6 +337,9 @@ uint8_t stpm3x_init(stpm3x_t *dev, const stpm3x_params_t *params);
 /**
  * @brief Lock SPI interface for the STPM3X device
  *
+ * The interface selected is the one of the transport of @p dev:
+ * SPI if SCS is low when EN rises, UART otherwise.
+ *
  * @param[in] dev           Initialized device descriptor of STPM3X device
  */
 void stpm3x_lock_spi_interface(stpm3x_t *dev);
@@ -123,56 +358,1727 @@ void stpm3x_reset_hw(stpm3x_t *dev);
  * @param[in]  reg          Address of register to read from
  * @param[out] value        Value read from register
  *
- * @return                  STPM3X_OK in any case
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR_CRC if the CRC of the answer is wrong
  */
-uint8_t stpm3x_read_reg(const stpm3x_t *dev, uint8_t reg, uint32_t *value);
+uint8_t stpm3x_read_reg(stpm3x_t *dev, uint8_t reg, uint32_t *value);
 
 /**
  * @brief Write one register to the STPM3X sensor
  *
+ * Configuration registers are also kept in the register shadow of @p dev.
+ *
  * @param[in]  dev          Device descriptor of STPM3X device to write
  * @param[in]  reg          Address of register to write
  * @param[out] value        Value to write in register
  *
- * @return                  STPM3X_OK in any case
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR if a transfer failed, the register shadow is still updated
  */
-uint8_t stpm3x_write_reg(const stpm3x_t *dev, uint8_t reg, const uint32_t *value);
+uint8_t stpm3x_write_reg(stpm3x_t *dev, uint8_t reg, const uint32_t *value);
 
 /**
- * @brief Read the instantaneous RMS current value from channel 1
+ * @brief Write several registers of the STPM3X in one pipelined burst
+ *
+ * @param[in]  dev          Device descriptor of STPM3X device to write
+ * @param[in]  regs         Addresses of the registers to write
+ * @param[in]  values       Values to write, same order as @p regs
+ * @param[in]  count        Number of registers to write
+ *
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR if a transfer failed, the register shadow is still updated
+ */
+uint8_t stpm3x_write_regs(stpm3x_t *dev, const uint8_t *regs, const uint32_t *values, size_t count);
+
+/**
+ * @brief Write one 16 bits half of a register of the STPM3X sensor
+ *
+ * @param[in]  dev          Device descriptor of STPM3X device to write
+ * @param[in]  addr         Address of the half: register address for the LSB, + 1 for the MSB
+ * @param[in]  value        Value to write in the half
+ *
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR if a transfer failed, the register shadow is still updated
+ */
+uint8_t stpm3x_write_half(stpm3x_t *dev, uint8_t addr, uint16_t value);
+
+/**
+ * @brief Read several registers of the STPM3X in one pipelined burst
+ *
+ * Each frame sent on the bus carries the address of the next register to read,
+ * so reading @p count registers costs @p count + 1 frames instead of 2 * @p count.
  *
  * @param[in]  dev          Device descriptor of STPM3X device to read from
+ * @param[in]  regs         Addresses of the registers to read, in burst order
+ * @param[out] values       Values read from the registers, same order as @p regs
+ * @param[in]  count        Number of registers to read
  *
- * @returns                 The instantaneous RMS current value read from channel 1
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR_CRC if the CRC of an answer is wrong, all registers are still read
  */
-uint16_t stpm3x_read_current_rms_1(const stpm3x_t *dev);
+uint8_t stpm3x_read_regs(stpm3x_t *dev, const uint8_t *regs, uint32_t *values, size_t count);
 
 /**
- * @brief Read the instantaneous RMS voltage value from channel 1
+ * @name    Transports
+ *
+ * A transport exchanges bursts of 5 bytes frames with the device. The
+ * register functions build the frames, the transport seals them with its CRC
+ * and moves them on its bus. The answers are checked with the same CRC.
+ * @{
+ */
+#ifndef STPM3X_BURST_FRAMES
+#define STPM3X_BURST_FRAMES             (8U)    /**< Frames handed to a transport at once */
+#endif
+#ifndef STPM3X_UART_BAUD_MAX
+#define STPM3X_UART_BAUD_MAX            (460800UL) /**< Fastest baud rate of the UART transport */
+#endif
+#ifndef STPM3X_UART_TIMEOUT_US
+#define STPM3X_UART_TIMEOUT_US          (2000U) /**< Answer delay allowed on top of the transmission time */
+#endif
+
+/**
+ * @brief Frame exchange operations of a bus
+ */
+struct stpm3x_transport {
+    /**
+     * @brief Set the bus up, before the interface selection
+     *
+     * @return              STPM3X_OK on success, STPM3X_ERROR otherwise
+     */
+    int (*init)(stpm3x_t *dev);
+    /**
+     * @brief Speed the link up once the device is configured, may be NULL
+     *
+     * @return              STPM3X_OK on success, STPM3X_ERROR if the initial speed is kept
+     */
+    uint8_t (*negotiate)(stpm3x_t *dev);
+    /**
+     * @brief Follow the bus settings of the device across a power cycle, may be NULL
+     *
+     * Called by stpm3x_resume() with @p reset true once the device left its
+     * power-on reset, then with @p reset false once US_REG2 was restored.
+     */
+    void (*resync)(stpm3x_t *dev, bool reset);
+    /**
+     * @brief Get exclusive access to the bus for a burst
+     */
+    void (*acquire)(stpm3x_t *dev);
+    /**
+     * @brief Exchange sealed frames, the answers are not checked
+     *
+     * @param[in]  out      @p frames frames to send
+     * @param[out] in       @p frames frames received
+     * @param[in]  frames   number of frames, at most STPM3X_BURST_FRAMES
+     *
+     * @return              STPM3X_OK on success, STPM3X_ERROR if the answers are missing
+     */
+    int (*transfer)(stpm3x_t *dev, const uint8_t *out, uint8_t *in, size_t frames);
+    /**
+     * @brief Release the bus at the end of a burst
+     */
+    void (*release)(stpm3x_t *dev);
+    /**
+     * @brief CRC of the 4 data bytes of a frame on this bus
+     */
+    uint8_t (*crc)(const uint8_t *frame);
+    uint8_t scs_level;              /**< level of SCS on EN rising selecting this interface */
+};
+
+/**
+ * @brief SPI transport, the default one
+ */
+extern const stpm3x_transport_t stpm3x_transport_spi;
+
+#if defined(MODULE_PERIPH_UART) || defined(DOXYGEN)
+/**
+ * @brief UART transport
+ *
+ * The device starts at 9600 bauds. When link training is enabled,
+ * stpm3x_init() negotiates the fastest baud rate up to
+ * stpm3x_params_t::baudrate that reads the device without CRC errors.
+ * The frames of a burst are written back to back, so that a DMA driven
+ * UART sends them in one go.
+ */
+extern const stpm3x_transport_t stpm3x_transport_uart;
+#endif
+/** @} */
+
+#if IS_USED(MODULE_STPM3X_TRACE) || defined(DOXYGEN)
+/**
+ * @name    Frame trace
+ *
+ * With the stpm3x_trace pseudo-module, every frame exchanged with a device
+ * whose stpm3x_params_t::trace is set is appended, with the time of its
+ * transfer, to a RAM ring of fixed-size records. The ring is exported as a
+ * header followed by the records, oldest first: over the shell (`stpm3x
+ * trace`, as hex) or to an MTD area.
+ *
+ * stpm3x_transport_replay plays such an export back: each frame sent by the
+ * driver gets the answer recorded for the same device, so that captures from
+ * the field run through the snapshot, aggregation and harmonic code on the
+ * `native` board. Frames sent that differ from the recorded ones are counted
+ * in stpm3x_trace_t::mismatches.
+ * @{
+ */
+#define STPM3X_TRACE_MAGIC              (0x52543353UL) /**< "S3TR" in little endian */
+#define STPM3X_TRACE_VERSION            (1U)    /**< Version of the export format */
+#ifndef STPM3X_TRACE_RESYNC
+#define STPM3X_TRACE_RESYNC             (64U)   /**< Records searched by the replay after a mismatch */
+#endif
+
+/**
+ * @brief Flags of a trace record
+ */
+enum {
+    STPM3X_TRACE_START   = 0x01,    /**< First frame of a transfer */
+    STPM3X_TRACE_LOST    = 0x02,    /**< The transfer failed, the answer is not valid */
+    STPM3X_TRACE_BAD_CRC = 0x04,    /**< The CRC of the answer was wrong */
+};
+
+/**
+ * @brief One frame exchanged with a device
+ */
+typedef struct {
+    uint32_t time;                  /**< Start of the transfer in [us] */
+    uint8_t out[5];                 /**< Frame sent */
+    uint8_t in[5];                  /**< Frame received */
+    uint8_t flags;                  /**< Combination of STPM3X_TRACE_* */
+    uint8_t id;                     /**< stpm3x_params_t::trace_id of the device */
+} stpm3x_trace_rec_t;
+
+/**
+ * @brief Header of an exported trace, followed by stpm3x_trace_hdr_t::count records
+ */
+typedef struct {
+    uint32_t magic;                 /**< STPM3X_TRACE_MAGIC */
+    uint16_t version;               /**< STPM3X_TRACE_VERSION */
+    uint16_t rec_size;              /**< sizeof(stpm3x_trace_rec_t) */
+    uint32_t count;                 /**< Number of records */
+    uint32_t lost;                  /**< Records overwritten before the export */
+} stpm3x_trace_hdr_t;
+
+/**
+ * @brief Frame trace
+ */
+struct stpm3x_trace {
+    mutex_t lock;                   /**< Serializes the devices recording to the trace */
+    stpm3x_trace_rec_t *buf;        /**< Records */
+    size_t size;                    /**< Capacity of the ring */
+    size_t head;                    /**< Next record written */
+    size_t count;                   /**< Records in the ring */
+    uint32_t lost;                  /**< Records overwritten since the initialization */
+    size_t pos;                     /**< Replay: next record played back */
+    uint32_t time;                  /**< Replay: time of the last record played back in [us] */
+    uint32_t mismatches;            /**< Replay: frames sent which differ from the recorded ones */
+};
+
+/**
+ * @brief Replay transport, answers the frames from stpm3x_params_t::trace
+ *
+ * The records of stpm3x_params_t::trace_id are played back in order. The
+ * answers are sealed with the SPI CRC, wrong if they were recorded with a bad
+ * CRC. A transfer fails when the trace is exhausted or was lost when recorded.
+ *
+ * When a frame sent differs from the recorded one, the replay skips up to
+ * STPM3X_TRACE_RESYNC records ahead to the next identical frame: frames only
+ * sent on the target, e.g. by the link training, do not shift the replay.
+ */
+extern const stpm3x_transport_t stpm3x_transport_replay;
+
+/**
+ * @brief Initialize an empty trace
+ *
+ * @param[out] trace        Trace to initialize
+ * @param[in]  buf          Memory for the records
+ * @param[in]  size         Number of records of @p buf
+ */
+void stpm3x_trace_init(stpm3x_trace_t *trace, stpm3x_trace_rec_t *buf, size_t size);
+
+/**
+ * @brief Load an exported trace for stpm3x_transport_replay
+ *
+ * The replay position is kept in the trace: load the export once for each
+ * device replayed.
+ *
+ * @param[out] trace        Trace to initialize, refers to @p data
+ * @param[in]  data         Exported trace: header and records
+ * @param[in]  len          Size of @p data in bytes
+ *
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR if @p data is not a trace of this version
+ */
+int stpm3x_trace_load(stpm3x_trace_t *trace, const void *data, size_t len);
+
+/**
+ * @brief Append the frames of one transfer, called by the driver
+ *
+ * @param[in]  trace        Trace to append to
+ * @param[in]  id           Id of the device
+ * @param[in]  time         Start of the transfer in [us]
+ * @param[in]  out          Frames sent
+ * @param[in]  in           Frames received
+ * @param[in]  frames       Number of frames
+ * @param[in]  lost         True if the transfer failed
+ * @param[in]  crc          CRC of the bus, to flag the answers with a bad CRC
+ */
+void stpm3x_trace_record(stpm3x_trace_t *trace, uint8_t id, uint32_t time, const uint8_t *out, const uint8_t *in,
+                         size_t frames, bool lost, uint8_t (*crc)(const uint8_t *frame));
+
+/**
+ * @brief Get the header of an export of the trace
+ *
+ * @param[in]  trace        Trace
+ * @param[out] hdr          Header of the records currently in the ring
+ */
+void stpm3x_trace_header(stpm3x_trace_t *trace, stpm3x_trace_hdr_t *hdr);
+
+/**
+ * @brief Get a record of the trace
+ *
+ * @param[in]  trace        Trace
+ * @param[in]  index        Index of the record, 0 for the oldest one
+ * @param[out] rec          Record
+ *
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR if there is no such record
+ */
+int stpm3x_trace_get(stpm3x_trace_t *trace, size_t index, stpm3x_trace_rec_t *rec);
+
+#if defined(MODULE_MTD) || defined(DOXYGEN)
+/**
+ * @brief Export the trace to an MTD area
+ *
+ * The area is erased first. Devices recording to the trace wait for the end
+ * of the export.
+ *
+ * @param[in]  trace        Trace
+ * @param[in]  mtd          MTD device
+ * @param[in]  addr         Start of the area, aligned on a sector
+ * @param[in]  size         Size of the area, the oldest records are left out if it is too small
+ *
+ * @return                  Number of bytes written
+ * @return                  STPM3X_ERROR on MTD error
+ */
+int stpm3x_trace_write(stpm3x_trace_t *trace, mtd_dev_t *mtd, uint32_t addr, uint32_t size);
+#endif
+/** @} */
+#endif
+
+/**
+ * @name    SPI link training
+ *
+ * stpm3x_init() tries the SPI clocks from the fastest one, reading known
+ * configuration registers with CRC checks, and keeps the fastest clock without
+ * errors, minus a margin. At runtime, each CRC error of an answer is counted
+ * and the clock steps down when too many errors happen in a window of frames.
+ * @{
+ */
+#ifndef STPM3X_LINK_TRAINING
+#define STPM3X_LINK_TRAINING            (1)     /**< Train the link in stpm3x_init() */
+#endif
+#ifndef STPM3X_LINK_TRAIN_BURSTS
+#define STPM3X_LINK_TRAIN_BURSTS        (16U)   /**< Bursts of 4 reads tried at each clock */
+#endif
+#ifndef STPM3X_LINK_MARGIN
+#define STPM3X_LINK_MARGIN              (1U)    /**< Clock steps kept below the fastest clock without errors */
+#endif
+#ifndef STPM3X_LINK_WINDOW
+#define STPM3X_LINK_WINDOW              (1024U) /**< Frames of the runtime error window */
+#endif
+#ifndef STPM3X_LINK_MAX_ERRORS
+#define STPM3X_LINK_MAX_ERRORS          (4U)    /**< Errors in a window stepping the clock down */
+#endif
+
+/**
+ * @brief Select the fastest SPI clock reading the device without errors
+ *
+ * @param[in]  dev          Initialized device descriptor of STPM3X device
+ *
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR if no clock works or @p dev is not on SPI, the clock is left unchanged
+ */
+uint8_t stpm3x_link_train(stpm3x_t *dev);
+/** @} */
+
+/**
+ * @brief Latch the measurements of both channels and read them in one burst
+ *
+ * Concurrent callers are serialized on the device. A caller which had to wait
+ * for a snapshot latched after it was called shares it, and the result of its
+ * read, instead of starting its own latch and read: callers arriving during a
+ * snapshot all share the next one, so N concurrent readers cost at most two
+ * bus transactions.
  *
  * @param[in]  dev          Device descriptor of STPM3X device to read from
+ * @param[out] snap         Snapshot of the latched registers
  *
- * @returns                 The instantaneous RMS voltage value in [mA] read from channel 1
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR_CRC if the CRC of an answer is wrong
  */
-uint16_t stpm3x_read_voltage_rms_1(const stpm3x_t *dev);
+uint8_t stpm3x_read_snapshot(stpm3x_t *dev, stpm3x_snapshot_t *snap);
 
 /**
- * @brief Read the instantaneous RMS current value from channel 2
+ * @brief Get the last snapshot if it is recent enough, read a new one otherwise
+ *
+ * A snapshot whose read failed is not reused.
  *
  * @param[in]  dev          Device descriptor of STPM3X device to read from
+ * @param[out] snap         Snapshot of the latched registers
+ * @param[in]  max_age      Maximum age of the last snapshot in [us]
  *
- * @returns                 The instantaneous RMS current value read from channel 2
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR_CRC if the CRC of an answer is wrong
  */
-uint16_t stpm3x_read_current_rms_2(const stpm3x_t *dev);
+uint8_t stpm3x_read_snapshot_recent(stpm3x_t *dev, stpm3x_snapshot_t *snap, uint32_t max_age);
 
 /**
- * @brief Read the instantaneous RMS voltage value from channel 2
+ * @brief Latch the measurements and read several registers in one burst
+ *
+ * The sequence is serialized with the other latch + read sequences on the device.
+ *
+ * @param[in]  dev          Device descriptor of STPM3X device to read from
+ * @param[in]  regs         Addresses of the registers to read, in burst order
+ * @param[out] values       Values read from the registers, same order as @p regs
+ * @param[in]  count        Number of registers to read
+ *
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR_CRC if the CRC of an answer is wrong
+ */
+uint8_t stpm3x_read_latched(stpm3x_t *dev, const uint8_t *regs, uint32_t *values, size_t count);
+
+/**
+ * @brief Same as stpm3x_read_latched(), and give the time of the latch
+ *
+ * @param[in]  dev          Device descriptor of STPM3X device to read from
+ * @param[in]  regs         Addresses of the registers to read, in burst order
+ * @param[out] values       Values read from the registers, same order as @p regs
+ * @param[in]  count        Number of registers to read
+ * @param[out] time         Time of the S/W latch in [us], may be NULL
+ *
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR_CRC if the CRC of an answer is wrong
+ */
+uint8_t stpm3x_read_latched_time(stpm3x_t *dev, const uint8_t *regs, uint32_t *values, size_t count,
+                                 uint32_t *time);
+
+/**
+ * @name    Sample timing
+ *
+ * Every snapshot and latched read is stamped with the time of its S/W latch,
+ * taken right after the latch frame went out, from the monotonic microsecond
+ * timebase of the driver, read by stpm3x_time_now() of stpm3x_time.h. The time
+ * wraps after about 71 minutes: compute intervals by unsigned subtraction.
+ *
+ * The intervals between successive timestamps feed running statistics, for
+ * the snapshots of each device in stpm3x_t::jitter and for the engine rounds.
+ * @{
+ */
+
+/**
+ * @brief Forget all the intervals
+ *
+ * @param[out] jitter       Statistics to reset
+ */
+void stpm3x_jitter_reset(stpm3x_jitter_t *jitter);
+
+/**
+ * @brief Add the interval from the previous timestamp to the statistics
+ *
+ * The first timestamp after a reset only starts the first interval.
+ *
+ * @param[inout] jitter     Statistics to update
+ * @param[in]    time       Timestamp in [us]
+ */
+void stpm3x_jitter_add(stpm3x_jitter_t *jitter, uint32_t time);
+
+/**
+ * @brief Compute the mean, extremes and standard deviation of the intervals
+ *
+ * @param[in]  jitter       Statistics
+ * @param[out] stats        Result, all zero when no interval was added
+ */
+void stpm3x_jitter_stats(const stpm3x_jitter_t *jitter, stpm3x_jitter_stats_t *stats);
+
+/**
+ * @brief Statistics of the intervals between the snapshots of a device
+ *
+ * @param[in]  dev          Device descriptor of STPM3X device
+ * @param[out] stats        Result
+ * @param[in]  reset        Restart the statistics once read
+ */
+void stpm3x_read_jitter(stpm3x_t *dev, stpm3x_jitter_stats_t *stats, bool reset);
+/** @} */
+
+/**
+ * @name    Field reads
+ *
+ * Fields are given by their index STPM3X_FIELD_<name> of stpm3x_regmap.h.
+ * Fields sharing a register are served by a single read of the register.
+ * @{
+ */
+#ifndef STPM3X_FIELDS_MAX
+#define STPM3X_FIELDS_MAX               (16U)   /**< Fields read at once by stpm3x_read_fields() */
+#endif
+
+/**
+ * @brief Plan the burst reading a set of fields
+ *
+ * @param[in]  fields       Indexes of the fields
+ * @param[in]  numof        Number of fields
+ * @param[out] regs         Registers to read, at most @p numof
+ * @param[out] slots        Index in @p regs of the register of each field
+ *
+ * @return                  Number of registers to read
+ */
+size_t stpm3x_plan_fields(const uint8_t *fields, size_t numof, uint8_t *regs, uint8_t *slots);
+
+/**
+ * @brief Latch the measurements and read a set of fields in one burst
  *
  * @param[in]  dev          Device descriptor of STPM3X device to read from
+ * @param[in]  fields       Indexes of the fields
+ * @param[in]  numof        Number of fields, at most STPM3X_FIELDS_MAX
+ * @param[out] values       Raw values of the fields, sign-extended
  *
- * @returns                 The instantaneous RMS current value read [mA] from channel 2
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR_CRC if the CRC of an answer is wrong
  */
-uint16_t stpm3x_read_voltage_rms_2(const stpm3x_t *dev);
+uint8_t stpm3x_read_fields(stpm3x_t *dev, const uint8_t *fields, size_t numof, int32_t *values);
+
+/**
+ * @brief Convert the raw value of a field with its LSB
+ *
+ * @param[in]  dev          Device descriptor of STPM3X device the value was read from
+ * @param[in]  field        Index of the field
+ * @param[in]  value        Raw value of the field
+ *
+ * @return                  Value in [uV], [uA], [uW], [uWh], [uAh] or [us], raw value if the field has no unit
+ */
+int64_t stpm3x_field_to_micro(const stpm3x_t *dev, uint8_t field, int32_t value);
+/** @} */
+
+/**
+ * @brief Convert a snapshot to full resolution measurements
+ *
+ * @param[in]  dev          Initialized device descriptor of STPM3X device
+ * @param[in]  snap         Snapshot read from @p dev
+ * @param[out] measure      Measurements of both channels
+ */
+void stpm3x_snapshot_to_measure(const stpm3x_t *dev, const stpm3x_snapshot_t *snap, stpm3x_measure_t *measure);
+
+/**
+ * @brief Read the full resolution measurements of both channels from one snapshot
+ *
+ * @param[in]  dev          Device descriptor of STPM3X device to read from
+ * @param[out] measure      Measurements of both channels
+ *
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR_CRC if the CRC of an answer is wrong
+ */
+uint8_t stpm3x_read_measure(stpm3x_t *dev, stpm3x_measure_t *measure);
+
+/**
+ * @brief Number of fields of a measurement record, see stpm3x_measure_to_fields()
+ */
+#define STPM3X_MEASURE_FIELDS           (8U)
+
+/**
+ * @brief Flatten measurements into a record for stpm3x_codec_encode()
+ *
+ * Fields are voltage, current, power and period of channel 1, then of channel 2.
+ *
+ * @param[in]  measure      Measurements of both channels
+ * @param[out] fields       Record of STPM3X_MEASURE_FIELDS fields
+ */
+void stpm3x_measure_to_fields(const stpm3x_measure_t *measure, int32_t *fields);
+
+/**
+ * @brief Compute line frequency, phase angle and power factor from a snapshot
+ *
+ * The angle is the phase register over the period register, the power factor
+ * its cosine from a table: integer math only.
+ *
+ * @param[in]  snap         Snapshot to convert
+ * @param[out] line         Line values of both channels, zero when no period is measured
+ */
+void stpm3x_snapshot_to_line(const stpm3x_snapshot_t *snap, stpm3x_line_t *line);
+
+/**
+ * @brief Read line frequency, phase angle and power factor of both channels from one snapshot
+ *
+ * @param[in]  dev          Device descriptor of STPM3X device to read from
+ * @param[out] line         Line values of both channels
+ *
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR_CRC if the CRC of an answer is wrong
+ */
+uint8_t stpm3x_read_line(stpm3x_t *dev, stpm3x_line_t *line);
+
+/**
+ * @brief Get the values of the latest snapshot without bus traffic nor lock
+ *
+ * This function can be called from any context, including interrupt handlers.
+ * All values returned come from the same latch. Snapshots whose read failed
+ * are not published.
+ *
+ * @param[in]  dev          Initialized device descriptor of STPM3X device
+ * @param[out] live         Values of the latest snapshot
+ *
+ * @return                  Sequence number of the snapshot, 0 if none was read yet
+ */
+uint32_t stpm3x_read_live(const stpm3x_t *dev, stpm3x_live_t *live);
+
+/**
+ * @brief Read the instantaneous RMS current value from channel 1
+ *
+ * @param[in]  dev          Device descriptor of STPM3X device to read from
+ *
+ * @returns                 The instantaneous RMS current value in [mA] read from channel 1,
+ *                          saturated to UINT16_MAX. Use stpm3x_read_measure() for full resolution.
+ */
+uint16_t stpm3x_read_current_rms_1(stpm3x_t *dev);
+
+/**
+ * @brief Read the instantaneous RMS voltage value from channel 1
+ *
+ * @param[in]  dev          Device descriptor of STPM3X device to read from
+ *
+ * @returns                 The instantaneous RMS voltage value in [mV] read from channel 1,
+ *                          saturated to UINT16_MAX. Use stpm3x_read_measure() for full resolution.
+ */
+uint16_t stpm3x_read_voltage_rms_1(stpm3x_t *dev);
+
+#if IS_USED(MODULE_STPM3X_CH2) || defined(DOXYGEN)
+/**
+ * @brief Read the instantaneous RMS current value from channel 2
+ *
+ * @param[in]  dev          Device descriptor of STPM3X device to read from
+ *
+ * @returns                 The instantaneous RMS current value in [mA] read from channel 2,
+ *                          saturated to UINT16_MAX. Use stpm3x_read_measure() for full resolution.
+ */
+uint16_t stpm3x_read_current_rms_2(stpm3x_t *dev);
+
+/**
+ * @brief Read the instantaneous RMS voltage value from channel 2
+ *
+ * @param[in]  dev          Device descriptor of STPM3X device to read from
+ *
+ * @returns                 The instantaneous RMS voltage value in [mV] read from channel 2,
+ *                          saturated to UINT16_MAX. Use stpm3x_read_measure() for full resolution.
+ */
+uint16_t stpm3x_read_voltage_rms_2(stpm3x_t *dev);
+#endif
+
+#if IS_USED(MODULE_STPM3X_WAVE) || defined(DOXYGEN)
+/**
+ * @name    Waveform capture and harmonic analysis
+ *
+ * Needs the stpm3x_wave pseudo-module.
+ * @{
+ */
+#ifndef STPM3X_HARMONICS_NUMOF
+#define STPM3X_HARMONICS_NUMOF          (8U)    /**< Number of harmonics analysed above the fundamental */
+#endif
+
+/**
+ * @brief Maximum number of samples of one channel analysed by stpm3x_harmonics_compute()
+ */
+#define STPM3X_HARMONICS_MAX_SAMPLES    (4096U)
+
+/**
+ * @brief Waveform channels, can be combined
+ */
+enum {
+    STPM3X_WAVE_V1 = 0x01,          /**< Instantaneous voltage of channel 1 (DSP_REG2) */
+    STPM3X_WAVE_C1 = 0x02,          /**< Instantaneous current of channel 1 (DSP_REG3) */
+    STPM3X_WAVE_V2 = 0x04,          /**< Instantaneous voltage of channel 2 (DSP_REG4) */
+    STPM3X_WAVE_C2 = 0x08,          /**< Instantaneous current of channel 2 (DSP_REG5) */
+};
+
+/**
+ * @brief Harmonic content of one waveform
+ */
+typedef struct {
+    uint32_t fundamental;           /**< Amplitude of the fundamental in raw counts */
+    uint32_t rms;                   /**< RMS value of the window without DC in raw counts */
+    uint16_t thd;                   /**< THD over the harmonics analysed in [0.01 %] */
+    uint16_t harmonic[STPM3X_HARMONICS_NUMOF]; /**< Amplitude of harmonics 2 to N + 1 in [0.01 %] of the fundamental */
+} stpm3x_harmonics_t;
+
+/**
+ * @brief Capture a window of instantaneous samples
+ *
+ * The samples of each channel are stored one channel after the other, in the
+ * order of STPM3X_WAVE_*: @p samples must hold @p count samples per channel.
+ * Each sampling instant costs one latch + burst read of the selected channels.
+ * The latch times tell the actual spacing of the samples.
+ *
+ * @param[in]  dev          Device descriptor of STPM3X device to read from
+ * @param[in]  channels     Channels to capture, combination of STPM3X_WAVE_*
+ * @param[out] samples      Sign extended 24 bits samples
+ * @param[out] times        Latch time of each sampling instant in [us], may be NULL
+ * @param[in]  count        Number of samples per channel
+ * @param[in]  sample_us    Sampling period in [us]
+ *
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR_CRC if the CRC of an answer is wrong, all samples are still captured
+ */
+uint8_t stpm3x_wave_capture(stpm3x_t *dev, uint8_t channels, int32_t *samples, uint32_t *times, size_t count,
+                            uint32_t sample_us);
+
+/**
+ * @brief Compute the THD and harmonic amplitudes of one captured channel
+ *
+ * A Goertzel filter is run on the fundamental and each harmonic below half of
+ * the sampling rate. Leakage is lowest when the window holds an integer number
+ * of line periods.
+ *
+ * @param[in]  samples      Samples of one channel, from stpm3x_wave_capture()
+ * @param[in]  count        Number of samples, at most STPM3X_HARMONICS_MAX_SAMPLES
+ * @param[in]  sample_us    Sampling period in [us]
+ * @param[in]  period_us    Line period in [us], see stpm3x_measure_t::period
+ * @param[out] res          Harmonic content of the waveform
+ *
+ * @return                  STPM3X_ERROR if the line period cannot be analysed at this sampling period
+ * @return                  STPM3X_OK on success
+ */
+int stpm3x_harmonics_compute(const int32_t *samples, size_t count, uint32_t sample_us, uint32_t period_us,
+                             stpm3x_harmonics_t *res);
+
+/**
+ * @brief Read the share of the active power carried by harmonics, without capture
+ *
+ * Uses the total and fundamental active power computed by the chip, read in
+ * one burst: share = (P - P_fund) / P.
+ *
+ * @param[in]  dev          Device descriptor of STPM3X device to read from
+ * @param[out] share        Share of channel 1/2 in [0.01 %], saturated to the int16_t range
+ *
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR_CRC if the CRC of an answer is wrong
+ */
+uint8_t stpm3x_read_harmonic_share(stpm3x_t *dev, int16_t share[2]);
+/** @} */
+#endif
+
+/**
+ * @name    Windowed aggregation
+ *
+ * Running min/max/mean/RMS of the measurements, updated in O(1) per sample
+ * with a memory use independent of the window length. Several windows can be
+ * computed from the same samples by feeding several aggregators.
+ * @{
+ */
+
+/**
+ * @brief Quantities aggregated, indexes of stpm3x_agg_result_t::value
+ */
+enum {
+    STPM3X_AGG_VOLTAGE1 = 0,        /**< RMS voltage of channel 1 in [uV] */
+    STPM3X_AGG_CURRENT1,            /**< RMS current of channel 1 in [uA] */
+    STPM3X_AGG_POWER1,              /**< Active power of channel 1 in [mW] */
+    STPM3X_AGG_VOLTAGE2,            /**< RMS voltage of channel 2 in [uV] */
+    STPM3X_AGG_CURRENT2,            /**< RMS current of channel 2 in [uA] */
+    STPM3X_AGG_POWER2,              /**< Active power of channel 2 in [mW] */
+    STPM3X_AGG_NUMOF                /**< number of quantities aggregated */
+};
+
+/**
+ * @brief Kind of window boundary
+ */
+typedef enum {
+    STPM3X_AGG_WINDOW_SAMPLES,      /**< window of a number of samples */
+    STPM3X_AGG_WINDOW_CYCLES,       /**< window of a number of line cycles of channel 1 */
+    STPM3X_AGG_WINDOW_TIME          /**< window of a duration in [us], aligned on the first sample */
+} stpm3x_agg_window_t;
+
+/**
+ * @brief Aggregate of one quantity over a window
+ */
+typedef struct {
+    int32_t min;                    /**< minimum value */
+    int32_t max;                    /**< maximum value */
+    int32_t mean;                   /**< mean value */
+    uint32_t rms;                   /**< quadratic mean value */
+} stpm3x_agg_value_t;
+
+/**
+ * @brief Aggregates of a completed window
+ */
+typedef struct {
+    uint32_t start;                 /**< start of the window in [us], end of the previous one */
+    uint32_t end;                   /**< time of the last sample in [us] */
+    uint32_t count;                 /**< number of samples */
+    stpm3x_agg_value_t value[STPM3X_AGG_NUMOF]; /**< aggregates, see STPM3X_AGG_* */
+} stpm3x_agg_result_t;
+
+/**
+ * @brief Callback receiving each completed window
+ */
+typedef void (*stpm3x_agg_cb_t)(const stpm3x_agg_result_t *res, void *arg);
+
+/**
+ * @brief Running sums of one quantity (internal)
+ */
+typedef struct {
+    int32_t min;                    /**< minimum value */
+    int32_t max;                    /**< maximum value */
+    int64_t sum;                    /**< sum of the values */
+    uint64_t sum_sq;                /**< sum of the squares of the values, lower 64 bits */
+    uint32_t sum_sq_hi;             /**< sum of the squares of the values, upper 32 bits */
+} stpm3x_agg_stat_t;
+
+/**
+ * @brief Aggregator of one window
+ */
+typedef struct {
+    stpm3x_agg_window_t window;     /**< kind of window boundary */
+    uint32_t length;                /**< length of the window, in samples, cycles or [us] */
+    stpm3x_agg_cb_t cb;             /**< callback receiving completed windows */
+    void *arg;                      /**< argument of the callback */
+    bool started;                   /**< true once the first sample was added */
+    uint32_t count;                 /**< number of samples in the current window */
+    uint32_t start;                 /**< start of the current window in [us] */
+    uint32_t last;                  /**< time of the last sample in [us] */
+    uint64_t cycles;                /**< line cycles elapsed in the current window, Q8 format */
+    stpm3x_agg_stat_t stat[STPM3X_AGG_NUMOF]; /**< running sums of the current window */
+} stpm3x_agg_t;
+
+/**
+ * @brief Initialize an aggregator
+ *
+ * @param[out] agg          Aggregator to initialize
+ * @param[in]  window       Kind of window boundary
+ * @param[in]  length       Length of the window, in samples, cycles or [us]
+ * @param[in]  cb           Callback receiving each completed window
+ * @param[in]  arg          Argument of the callback
+ */
+void stpm3x_agg_init(stpm3x_agg_t *agg, stpm3x_agg_window_t window, uint32_t length,
+                     stpm3x_agg_cb_t cb, void *arg);
+
+/**
+ * @brief Add one sample to an aggregator, calling its callback if the window is complete
+ *
+ * Windows are contiguous: each one starts where the previous one ended. A time
+ * window is only complete once a sample past its end is added.
+ *
+ * @param[in]  agg          Aggregator to update
+ * @param[in]  measure      Measurements of the sample
+ * @param[in]  now          Time of the sample in [us]
+ */
+void stpm3x_agg_update(stpm3x_agg_t *agg, const stpm3x_measure_t *measure, uint32_t now);
+
+/**
+ * @brief Read one sample and add it to several aggregators
+ *
+ * The sample is dropped if its read fails.
+ *
+ * @param[in]  dev          Device descriptor of STPM3X device to read from
+ * @param[in]  aggs         Aggregators to update
+ * @param[in]  numof        Number of aggregators
+ *
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR_CRC if the CRC of an answer is wrong
+ */
+uint8_t stpm3x_agg_read(stpm3x_t *dev, stpm3x_agg_t *aggs, size_t numof);
+/** @} */
+
+/**
+ * @name    SenML export
+ *
+ * A snapshot is encoded as a SenML CBOR pack (RFC 8428) with one record per
+ * quantity and channel. The first record of each channel carries its base
+ * name, `<name>ph1:` or `<name>ph2:`, the following ones only the quantity name
+ * and unit: voltage [V], current [A], power [W] and frequency [Hz].
+ * Values are float32 and the records carry no time, i.e. "now".
+ * @{
+ */
+#define STPM3X_SENML_RECORDS            (8U)    /**< Number of records of a pack */
+
+/**
+ * @brief Maximum size of a pack in bytes for a base name prefix of @p name_len characters (< 252)
+ */
+#define STPM3X_SENML_CBOR_SIZE(name_len) (1 + (2 * (84 + (name_len))))
+
+/**
+ * @brief Encode a snapshot as SenML CBOR in one pass
+ *
+ * @param[in]  dev          Device descriptor the snapshot was read from
+ * @param[in]  snap         Snapshot to encode
+ * @param[in]  name         Prefix of the base names, e.g. "urn:dev:mac:0024befffe804ff1:", can be NULL
+ * @param[out] buf          Output buffer
+ * @param[in]  len          Size of @p buf, see STPM3X_SENML_CBOR_SIZE()
+ *
+ * @return                  Number of bytes written
+ * @return                  STPM3X_ERROR if @p buf is too small
+ */
+int stpm3x_snapshot_to_senml_cbor(const stpm3x_t *dev, const stpm3x_snapshot_t *snap, const char *name,
+                                  uint8_t *buf, size_t len);
+/** @} */
+
+/**
+ * @name    Current gain autoranging
+ *
+ * Each current channel switches between the gains 2, 4, 8 and 16 with one
+ * half-register write of DFE_CR1/DFE_CR2. The LSB values of the channel are
+ * rescaled at the switch and the snapshots taken while the RMS filter
+ * settles are flagged in stpm3x_snapshot_t::ranging.
+ * @{
+ */
+#ifndef STPM3X_GAIN_SETTLE_US
+#define STPM3X_GAIN_SETTLE_US           (100000U) /**< Settling time of the RMS values after a gain switch */
+#endif
+
+/**
+ * @brief Autoranging thresholds, in [1/1000] of the full scale of the current RMS value
+ *
+ * The gain is halved above @ref high and doubled below @ref low: @ref low must
+ * be below half of @ref high for the hysteresis to hold.
+ */
+typedef struct {
+    uint16_t high;                  /**< Threshold to halve the gain */
+    uint16_t low;                   /**< Threshold to double the gain */
+} stpm3x_autorange_t;
+
+/**
+ * @brief Default thresholds: 75 % and 30 % of the full scale
+ */
+#define STPM3X_AUTORANGE_DEFAULT        { .high = 750, .low = 300 }
+
+/**
+ * @brief Set the gain of a current channel
+ *
+ * @param[in]  dev          Initialized device descriptor of STPM3X device
+ * @param[in]  channel      Channel 0 or 1
+ * @param[in]  gain         2, 4, 8 or 16
+ *
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR if @p gain is not supported or could not be written
+ */
+uint8_t stpm3x_set_gain(stpm3x_t *dev, unsigned channel, uint8_t gain);
+
+/**
+ * @brief Switch the gains by one step if a current RMS value of a snapshot is out of range
+ *
+ * @param[in]  dev          Device descriptor the snapshot was read from
+ * @param[in]  snap         Snapshot to check, skipped for channels still settling
+ * @param[in]  range        Thresholds
+ *
+ * @return                  Bit i set if the gain of channel i + 1 switched
+ */
+uint8_t stpm3x_autorange(stpm3x_t *dev, const stpm3x_snapshot_t *snap, const stpm3x_autorange_t *range);
+/** @} */
+
+#if IS_USED(MODULE_STPM3X_CALIB) || defined(DOXYGEN)
+/**
+ * @name    Calibration
+ *
+ * A calibration record holds the calibration fields of DSP_CR4 (phase
+ * compensation), DSP_CR5 to DSP_CR8 (CHV/CHC gain calibrators) and DSP_CR9 to
+ * DSP_CR12 (power offsets), with a version and a CRC16-CCITT. The other
+ * fields of these registers, e.g. the sag and swell thresholds, are left
+ * as they are when a record is applied.
+ *
+ * A calibrator CH of 12 bits scales its channel by 0.875 + CH / 16384, i.e.
+ * +/- 12.5 % around STPM3X_CALIB_UNITY.
+ *
+ * With MTD, stpm3x_init() loads the record of the device from
+ * stpm3x_params_t::calib_mtd and applies it, or the reset values if the
+ * record is not valid.
+ *
+ * Needs the stpm3x_calib pseudo-module.
+ * @{
+ */
+#define STPM3X_CALIB_MAGIC              (0x43335453UL) /**< "ST3C" in little endian */
+#define STPM3X_CALIB_VERSION            (1U)    /**< Version of the record format */
+#define STPM3X_CALIB_NUMOF              (9U)    /**< Registers of a record, DSP_CR4 to DSP_CR12 */
+#define STPM3X_CALIB_UNITY              (0x800U) /**< Calibrator leaving its channel unscaled */
+#ifndef STPM3X_CALIB_SAMPLES
+#define STPM3X_CALIB_SAMPLES            (16U)   /**< Measures averaged by stpm3x_calib_run() */
+#endif
+#ifndef STPM3X_CALIB_INTERVAL_US
+#define STPM3X_CALIB_INTERVAL_US        (100000U) /**< Interval between these measures in [us] */
+#endif
+
+/**
+ * @brief Calibration record, as stored in MTD
+ */
+typedef struct {
+    uint32_t magic;                 /**< STPM3X_CALIB_MAGIC */
+    uint16_t version;               /**< STPM3X_CALIB_VERSION */
+    uint16_t size;                  /**< sizeof(stpm3x_calib_t) */
+    uint32_t reg[STPM3X_CALIB_NUMOF]; /**< DSP_CR4 to DSP_CR12, only their calibration fields are applied */
+    uint16_t crc;                   /**< CRC16-CCITT of the bytes before it */
+    uint16_t reserved;              /**< 0 */
+} stpm3x_calib_t;
+
+/**
+ * @brief Reference load of stpm3x_calib_run()
+ *
+ * A value of 0 leaves the calibrator of its channel unchanged.
+ */
+typedef struct {
+    uint32_t voltage[2];            /**< RMS voltage applied to channel 1/2 in [uV] */
+    uint32_t current[2];            /**< RMS current drawn through channel 1/2 in [uA] */
+} stpm3x_calib_ref_t;
+
+/**
+ * @brief Fill a record with the reset values of the registers, and seal it
+ *
+ * @param[out] calib        Record
+ */
+void stpm3x_calib_default(stpm3x_calib_t *calib);
+
+/**
+ * @brief Fill a record with the calibration in use on a device, and seal it
+ *
+ * @param[in]  dev          Initialized device descriptor of STPM3X device
+ * @param[out] calib        Record
+ */
+void stpm3x_calib_get(const stpm3x_t *dev, stpm3x_calib_t *calib);
+
+/**
+ * @brief Compute the CRC of a record after a change of its registers
+ *
+ * @param[inout] calib      Record
+ */
+void stpm3x_calib_seal(stpm3x_calib_t *calib);
+
+/**
+ * @brief Check the magic, version, size and CRC of a record
+ *
+ * @param[in]  calib        Record
+ *
+ * @return                  true if the record is valid
+ */
+bool stpm3x_calib_valid(const stpm3x_calib_t *calib);
+
+/**
+ * @brief Write the calibration fields of a record in one burst, and read them back
+ *
+ * @param[in]  dev          Initialized device descriptor of STPM3X device
+ * @param[in]  calib        Valid record
+ *
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR if @p calib is not valid or the device did not take it
+ */
+int stpm3x_calib_apply(stpm3x_t *dev, const stpm3x_calib_t *calib);
+
+/**
+ * @brief Compute the gain calibrators against a reference load
+ *
+ * The measures of STPM3X_CALIB_SAMPLES snapshots are averaged, then each
+ * calibrator is rescaled by the ratio of the reference value to the measured
+ * one. The result is only applied by stpm3x_calib_apply().
+ *
+ * @param[in]  dev          Initialized device descriptor of STPM3X device, under the reference load
+ * @param[in]  ref          Reference values
+ * @param[out] calib        Calibration in use with the new calibrators, sealed
+ *
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR if a measure was 0 or a calibrator is out of range
+ */
+int stpm3x_calib_run(stpm3x_t *dev, const stpm3x_calib_ref_t *ref, stpm3x_calib_t *calib);
+
+#if defined(MODULE_MTD) || defined(DOXYGEN)
+/**
+ * @brief Read a record from an MTD area and apply it, or the reset values if it is not valid
+ *
+ * @param[in]  dev          Initialized device descriptor of STPM3X device
+ * @param[in]  mtd          MTD device
+ * @param[in]  addr         Address of the record
+ *
+ * @return                  STPM3X_OK if the record was applied
+ * @return                  STPM3X_ERROR if the reset values were applied instead
+ */
+int stpm3x_calib_load(stpm3x_t *dev, mtd_dev_t *mtd, uint32_t addr);
+
+/**
+ * @brief Store a record to an MTD area
+ *
+ * @param[in]  calib        Valid record
+ * @param[in]  mtd          MTD device
+ * @param[in]  addr         Address of the record, at the start of a sector
+ *
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR if @p calib is not valid or on MTD error
+ */
+int stpm3x_calib_store(const stpm3x_calib_t *calib, mtd_dev_t *mtd, uint32_t addr);
+#endif
+/** @} */
+#endif
+
+/**
+ * @name    Adaptive polling
+ *
+ * The poll interval doubles, up to a maximum, as long as the readings stay
+ * within a deadband around the last reference reading, and falls back to the
+ * minimum when a reading leaves it. A DSP event (sag, swell or power sign
+ * change) reported on INT1/INT2 wakes the poller immediately.
+ *
+ * Events are cleared by the poller: when the power quality recorder is also
+ * used, leave STPM3X_POLL_EV_SAG and STPM3X_POLL_EV_SWELL out of the events
+ * and call stpm3x_poll_kick() from the callback of stpm3x_pq_init().
+ * @{
+ */
+/**
+ * @brief DSP events waking the poller
+ */
+enum {
+    STPM3X_POLL_EV_SAG   = 0x01,    /**< voltage sag start */
+    STPM3X_POLL_EV_SWELL = 0x02,    /**< voltage or current swell start */
+    STPM3X_POLL_EV_SIGN  = 0x04,    /**< active power sign change */
+};
+
+/**
+ * @brief Reason of a poll
+ */
+typedef enum {
+    STPM3X_POLL_STEADY = 0,         /**< timer, reading within the deadband */
+    STPM3X_POLL_CHANGE,             /**< timer, reading out of the deadband */
+    STPM3X_POLL_EVENT,              /**< DSP event or stpm3x_poll_kick() */
+} stpm3x_poll_res_t;
+
+/**
+ * @brief Adaptive polling configuration
+ */
+typedef struct {
+    uint32_t min_interval;          /**< Fast poll interval in [us] */
+    uint32_t max_interval;          /**< Slowest poll interval in [us] */
+    uint32_t deadband_v;            /**< Voltage deadband in [uV] */
+    uint32_t deadband_c;            /**< Current deadband in [uA] */
+    uint32_t deadband_p;            /**< Power deadband in [mW] */
+    uint8_t events;                 /**< DSP events enabled on INT1/INT2, see STPM3X_POLL_EV_*, ignored without stpm3x_irq */
+} stpm3x_poll_config_t;
+
+/**
+ * @brief Adaptive poller
+ */
+typedef struct {
+    stpm3x_t *dev;                  /**< Device polled */
+    stpm3x_poll_config_t config;    /**< Configuration */
+    mutex_t wake;                   /**< Unlocked to wake the poller early */
+    uint32_t interval;              /**< Current poll interval in [us] */
+    uint32_t last;                  /**< Time of the last poll in [us] */
+    stpm3x_measure_t ref;           /**< Reading the deadband is centered on */
+} stpm3x_poll_t;
+
+/**
+ * @brief Initialize a poller, program the DSP events and take the reference reading
+ *
+ * @param[out] poll         Poller to initialize
+ * @param[in]  dev          Initialized device descriptor of STPM3X device
+ * @param[in]  config       Configuration, copied
+ *
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR_GPIO if an interrupt pin could not be configured
+ */
+int stpm3x_poll_init(stpm3x_poll_t *poll, stpm3x_t *dev, const stpm3x_poll_config_t *config);
+
+/**
+ * @brief Wake the poller before the end of its interval, safe from interrupt context
+ *
+ * @param[in]  poll         Poller to wake
+ */
+void stpm3x_poll_kick(stpm3x_poll_t *poll);
+
+/**
+ * @brief Wait for the end of the interval or for an event, then read the measurements
+ *
+ * @param[in]  poll         Poller
+ * @param[out] measure      Measurements of both channels
+ *
+ * @return                  Reason of the poll, see stpm3x_poll_res_t
+ */
+int stpm3x_poll_next(stpm3x_poll_t *poll, stpm3x_measure_t *measure);
+/** @} */
+
+#if IS_USED(MODULE_STPM3X_ENERGY) || defined(DOXYGEN)
+/**
+ * @name    Chip-side accumulation
+ *
+ * For billing-only deployments, the chip integrates energy and charge by
+ * itself: the host reads the accumulators only once per interval and derives
+ * the averages from their differences. The interval must be shorter than the
+ * time an accumulator takes to move by 2^31 LSB.
+ *
+ * Needs the stpm3x_energy pseudo-module.
+ * @{
+ */
+/**
+ * @brief Energy and charge over one interval
+ */
+typedef struct {
+    uint32_t interval;              /**< Duration of the interval in [ms] */
+    int64_t energy[2];              /**< Active energy of channel 1/2 in [uWh] */
+    int64_t charge[2];              /**< Charge of channel 1/2 in [uAh] */
+    int32_t power[2];               /**< Average active power of channel 1/2 in [mW] */
+    int32_t current[2];             /**< Average current of channel 1/2 in [uA] */
+} stpm3x_acc_result_t;
+
+/**
+ * @brief Accumulation state
+ */
+typedef struct {
+    stpm3x_t *dev;                  /**< Device read */
+    uint32_t interval;              /**< Time between two reads in [ms] */
+    uint64_t time;                  /**< Time of the last read in [us] */
+    uint32_t raw[4];                /**< Last PH1/PH2 active energy and PH1/PH2 AH_ACC */
+    int64_t energy[2];              /**< Active energy of channel 1/2 since the start in [uWh] */
+    int64_t charge[2];              /**< Charge of channel 1/2 since the start in [uAh] */
+} stpm3x_acc_t;
+
+/**
+ * @brief Enable cumulative energy and ampere-hour accumulation, and read the starting values
+ *
+ * @param[out] acc          Accumulation state
+ * @param[in]  dev          Initialized device descriptor of STPM3X device
+ * @param[in]  interval     Time between two reads in [ms]
+ *
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR_CRC if the CRC of an answer is wrong
+ */
+uint8_t stpm3x_acc_start(stpm3x_acc_t *acc, stpm3x_t *dev, uint32_t interval);
+
+/**
+ * @brief Read the accumulators and compute the values since the previous read
+ *
+ * On error @p res and the state are left unchanged: the next successful read
+ * covers the interval of the failed one too.
+ *
+ * @param[in]  acc          Accumulation state
+ * @param[out] res          Values over the elapsed interval
+ *
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR_CRC if the CRC of an answer is wrong
+ */
+uint8_t stpm3x_acc_read(stpm3x_acc_t *acc, stpm3x_acc_result_t *res);
+
+/**
+ * @brief Sleep until the end of the interval, then read the accumulators
+ *
+ * @param[in]  acc          Accumulation state
+ * @param[out] res          Values over the interval
+ *
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR_CRC if the CRC of an answer is wrong
+ */
+uint8_t stpm3x_acc_next(stpm3x_acc_t *acc, stpm3x_acc_result_t *res);
+/** @} */
+
+/**
+ * @name    Ampere-hour accounting
+ *
+ * The chip integrates the current of each channel into its AH_ACC
+ * accumulator (PH1_REG12, PH2_REG12) while the current RMS value is between
+ * the AH_UP and AH_DOWN thresholds of DSP_CR9 to DSP_CR12. The host reads
+ * both accumulators in one latched burst and extends them to 64 bits: it can
+ * sleep between two reads as long as an accumulator moves by less than 2^31
+ * LSB, see stpm3x_lsb_t::charge.
+ *
+ * Needs the stpm3x_energy pseudo-module.
+ * @{
+ */
+/**
+ * @brief AH_UP and AH_DOWN thresholds, 12 bits values in the scale of the current RMS registers
+ */
+typedef struct {
+    uint16_t up[2];                 /**< AH_UP of channel 1/2, 0 to accumulate at any current */
+    uint16_t down[2];               /**< AH_DOWN of channel 1/2 */
+} stpm3x_ah_config_t;
+
+/**
+ * @brief Thresholds accumulating the charge at any current
+ */
+#define STPM3X_AH_CONFIG_DEFAULT        { .up = { 0, 0 }, .down = { 0, 0 } }
+
+/**
+ * @brief Ampere-hour accounting state
+ */
+typedef struct {
+    stpm3x_t *dev;                  /**< Device read */
+    uint32_t time;                  /**< Latch time of the last read in [us] */
+    uint32_t raw[2];                /**< Last PH1/PH2 AH_ACC */
+    int64_t count[2];               /**< Accumulator of channel 1/2 extended to 64 bits, in LSB since the start */
+    int64_t charge[2];              /**< Charge of channel 1/2 since the start in [nAh] */
+    int32_t rem[2];                 /**< Charge of channel 1/2 not yet counted in the charge, in [pAh] */
+} stpm3x_ah_t;
+
+/**
+ * @brief Enable the ampere-hour accumulation with the given thresholds, and read the starting values
+ *
+ * @param[out] ah           Accounting state
+ * @param[in]  dev          Initialized device descriptor of STPM3X device
+ * @param[in]  config       AH_UP and AH_DOWN thresholds
+ *
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR_CRC if the CRC of an answer is wrong
+ */
+uint8_t stpm3x_ah_start(stpm3x_ah_t *ah, stpm3x_t *dev, const stpm3x_ah_config_t *config);
+
+/**
+ * @brief Read both accumulators in one burst and update the charge since the start
+ *
+ * On error @p ah and @p mah are left unchanged.
+ *
+ * @param[inout] ah         Accounting state
+ * @param[out]   mah        Charge of channel 1/2 since the start in [mAh], may be NULL
+ *
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR_CRC if the CRC of an answer is wrong
+ */
+uint8_t stpm3x_ah_read(stpm3x_ah_t *ah, int32_t *mah);
+/** @} */
+#endif
+
+/**
+ * @name    Low-power acquisition
+ *
+ * The chip is powered through the EN pin only for each measurement window.
+ * Power-down loses every register: stpm3x_resume() restores, from the register
+ * shadow kept in RAM, the registers which differ from their reset value, in
+ * one pipelined write, without the DSP reset pulses of stpm3x_init().
+ * @{
+ */
+/**
+ * @brief Timings of a measurement window, all in [us]
+ */
+typedef struct {
+    uint32_t startup;               /**< EN rising to first SPI frame, at least STPM3X_T_STARTUP_MIN */
+    uint32_t settle;                /**< Restored configuration to first valid measurement */
+    uint32_t on_time;               /**< Power-on time left for the measurement after @ref settle */
+} stpm3x_lp_t;
+
+/**
+ * @brief Default timings: datasheet startup time, 200 ms of settling, no extra on-time
+ */
+#define STPM3X_LP_DEFAULT               { .startup = 35000, .settle = 200000, .on_time = 0 }
+
+/**
+ * @brief Power the device down
+ *
+ * EN, SCS and SYN are driven low. The device must not be accessed until
+ * stpm3x_resume() is called.
+ *
+ * @param[in]  dev          Initialized device descriptor of STPM3X device
+ */
+void stpm3x_power_down(stpm3x_t *dev);
+
+/**
+ * @brief Power the device up and restore its configuration
+ *
+ * Waits @p lp->startup before the restore and @p lp->settle after it.
+ *
+ * @param[in]  dev          Device descriptor of STPM3X device powered down by stpm3x_power_down()
+ * @param[in]  lp           Timings of the measurement window
+ *
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR if the configuration read back differs from the shadow
+ */
+uint8_t stpm3x_resume(stpm3x_t *dev, const stpm3x_lp_t *lp);
+
+/**
+ * @brief Run one measurement window: resume, measure at the end of the on-time, power down
+ *
+ * @param[in]  dev          Device descriptor of STPM3X device powered down by stpm3x_power_down()
+ * @param[in]  lp           Timings of the measurement window
+ * @param[out] measure      Measurements of both channels
+ *
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR if the device could not be resumed
+ */
+uint8_t stpm3x_lp_measure(stpm3x_t *dev, const stpm3x_lp_t *lp, stpm3x_measure_t *measure);
+/** @} */
+
+#if IS_USED(MODULE_STPM3X_IRQ) || defined(DOXYGEN)
+/**
+ * @name    Power quality events
+ *
+ * The chip detects sags and swells against programmable thresholds and
+ * latches their start and end flags in DSP_SR1/SR2, so events shorter than a
+ * line cycle are caught whatever the poll rate. stpm3x_pq_poll() reads the
+ * flags and the durations in one latched burst, clears the flags and appends
+ * the events to a fixed-size RAM ring, which stpm3x_pq_flush() writes to an
+ * MTD area in batches.
+ *
+ * If the INT1/INT2 pins are connected, the chip also raises them on these
+ * events: the callback given to stpm3x_pq_init() runs in interrupt context
+ * and should only wake up the thread calling stpm3x_pq_poll().
+ *
+ * Needs the stpm3x_irq pseudo-module.
+ * @{
+ */
+#ifndef STPM3X_PQ_RING_SIZE
+#define STPM3X_PQ_RING_SIZE             (16U)   /**< Number of events kept in RAM */
+#endif
+
+/**
+ * @brief Kind of power quality event
+ */
+typedef enum {
+    STPM3X_PQ_SAG = 0,              /**< voltage sag */
+    STPM3X_PQ_SWELL_V,              /**< voltage swell */
+    STPM3X_PQ_SWELL_C,              /**< current swell */
+} stpm3x_pq_type_t;
+
+/**
+ * @brief Power quality event, 16 bytes as written to the log
+ */
+typedef struct {
+    uint32_t seq;                   /**< Event number since stpm3x_pq_init() */
+    uint32_t time;                  /**< Time of detection in [us] */
+    uint32_t duration;              /**< Duration in [us] for an end event, 0 for a start */
+    uint8_t type;                   /**< See stpm3x_pq_type_t */
+    uint8_t channel;                /**< Channel 0 or 1 */
+    uint8_t end;                    /**< 0 for the start of the event, 1 for its end */
+    uint8_t lost;                   /**< Events dropped from a full ring before this one, saturated */
+} stpm3x_pq_event_t;
+
+/**
+ * @brief Sag and swell thresholds of both channels
+ *
+ * A threshold of 0 disables the detection.
+ */
+typedef struct {
+    uint32_t sag[2];                /**< Sag voltage threshold in [mV] */
+    uint32_t swell_v[2];            /**< Swell voltage threshold in [mV] */
+    uint32_t swell_c[2];            /**< Swell current threshold in [mA] */
+    uint32_t sag_time;              /**< Minimum sag duration in [us] */
+} stpm3x_pq_config_t;
+
+/**
+ * @brief Power quality event recorder
+ */
+typedef struct {
+    stpm3x_t *dev;                  /**< Device monitored */
+    mutex_t lock;                   /**< Protects the ring */
+    stpm3x_pq_event_t ring[STPM3X_PQ_RING_SIZE]; /**< Events not flushed yet */
+    uint16_t head;                  /**< Index of the next event in @ref ring */
+    uint16_t count;                 /**< Number of events in @ref ring */
+    uint32_t seq;                   /**< Number of the next event */
+    uint8_t lost;                   /**< Events dropped since the last one stored */
+#ifdef MODULE_MTD
+    mtd_dev_t *mtd;                 /**< Log device, NULL if none */
+    uint32_t log_start;             /**< First byte of the log area */
+    uint32_t log_size;              /**< Size of the log area */
+    uint32_t log_pos;               /**< Next byte written in the log area */
+#endif
+} stpm3x_pq_t;
+
+/**
+ * @brief Initialize an event recorder
+ *
+ * @param[out] pq           Recorder to initialize
+ * @param[in]  dev          Initialized device descriptor of STPM3X device
+ * @param[in]  cb           Called from the INT1/INT2 interrupts, can be NULL
+ * @param[in]  arg          Argument of @p cb
+ *
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR_GPIO if an interrupt pin could not be configured
+ */
+int stpm3x_pq_init(stpm3x_pq_t *pq, stpm3x_t *dev, gpio_cb_t cb, void *arg);
+
+/**
+ * @brief Program the thresholds and enable the sag/swell interrupts
+ *
+ * @param[in]  pq           Event recorder
+ * @param[in]  config       Thresholds of both channels
+ *
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR or STPM3X_ERROR_CRC if a register could not be updated,
+ *                          the following ones are left unchanged
+ */
+uint8_t stpm3x_pq_config(stpm3x_pq_t *pq, const stpm3x_pq_config_t *config);
+
+/**
+ * @brief Read and clear the event flags, and record the events
+ *
+ * @param[in]  pq           Event recorder
+ *
+ * @return                  Number of events recorded
+ */
+unsigned stpm3x_pq_poll(stpm3x_pq_t *pq);
+
+/**
+ * @brief Take the oldest event out of the ring
+ *
+ * @param[in]  pq           Event recorder
+ * @param[out] event        Oldest event
+ *
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR if the ring is empty
+ */
+int stpm3x_pq_pop(stpm3x_pq_t *pq, stpm3x_pq_event_t *event);
+
+#if defined(MODULE_MTD) || defined(DOXYGEN)
+/**
+ * @brief Set the MTD area receiving the events
+ *
+ * The area is used as a circular log of stpm3x_pq_event_t, each sector is
+ * erased when the log enters it.
+ *
+ * @param[in]  pq           Event recorder
+ * @param[in]  mtd          Initialized MTD device
+ * @param[in]  start        First byte of the area, aligned on a sector
+ * @param[in]  size         Size of the area, multiple of the sector size
+ */
+void stpm3x_pq_set_log(stpm3x_pq_t *pq, mtd_dev_t *mtd, uint32_t start, uint32_t size);
+
+/**
+ * @brief Write the events of the ring to the log in batches
+ *
+ * @param[in]  pq           Event recorder
+ *
+ * @return                  STPM3X_OK on success, the ring is empty
+ * @return                  STPM3X_ERROR if no log is set or on MTD error, remaining events stay in the ring
+ */
+int stpm3x_pq_flush(stpm3x_pq_t *pq);
+#endif
+/** @} */
+#endif
+
+/**
+ * @name    SAUL interface
+ *
+ * Each STPM3X registers three SAUL entries, filled from one snapshot:
+ * - phase 1 and phase 2: (RMS voltage, RMS current, active power)
+ * - line: (period of channel 1, line frequency, power factor of channel 1)
+ *
+ * The values of one reading do not share a unit: `phydat_t::unit` is UNIT_NONE
+ * and each value has a base scale given below. `phydat_t::scale` is chosen for
+ * each reading as the smallest shift making all values fit in int16_t, i.e.
+ * `val[i] * 10^(base scale of i + scale)` is the value in its SI unit.
+ * Values still out of range saturate.
+ * @{
+ */
+#define STPM3X_SAUL_SCALE_VOLTAGE       (-2)    /**< RMS voltage in [10 mV] */
+#define STPM3X_SAUL_SCALE_CURRENT       (-3)    /**< RMS current in [mA] */
+#define STPM3X_SAUL_SCALE_POWER         (0)     /**< Active power in [W] */
+#define STPM3X_SAUL_SCALE_PERIOD        (-6)    /**< Period in [us] */
+#define STPM3X_SAUL_SCALE_FREQUENCY     (-2)    /**< Line frequency in [10 mHz] */
+#define STPM3X_SAUL_SCALE_PF            (-3)    /**< Power factor in [1/1000] */
+
+#ifndef STPM3X_SAUL_MAX_AGE_US
+#define STPM3X_SAUL_MAX_AGE_US          (100000U) /**< Maximum age of a snapshot shared between SAUL reads */
+#endif
+/** @} */
+
+/**
+ * @name    Asynchronous request queue
+ *
+ * Requests are submitted to the queue of the SPI bus the device is on and
+ * served by a worker thread, so the caller does not wait for the SPI exchange.
+ * Pending snapshot requests on the same device are merged and served by one
+ * latch + burst read, up to a write request to the device. Consecutive writes
+ * to the same register are merged into one write of the last value.
+ * @{
+ */
+/**
+ * @brief Message type sent to the submitter when a request without callback is done
+ */
+#define STPM3X_ASYNC_MSG_DONE           (0x5333)
+
+/**
+ * @brief Type of an asynchronous request
+ */
+typedef enum {
+    STPM3X_REQ_SNAPSHOT,            /**< latch + snapshot read into stpm3x_req_t::snap */
+    STPM3X_REQ_WRITE                /**< write stpm3x_req_t::value into stpm3x_req_t::reg */
+} stpm3x_req_type_t;
+
+/**
+ * @brief Forward declaration of an asynchronous request
+ */
+typedef struct stpm3x_req stpm3x_req_t;
+
+/**
+ * @brief Completion callback of an asynchronous request, called from the worker thread
+ */
+typedef void (*stpm3x_req_cb_t)(stpm3x_req_t *req, void *arg);
+
+/**
+ * @brief Asynchronous request, owned by the caller until it completes
+ */
+struct stpm3x_req {
+    stpm3x_req_t *next;             /**< next request in the queue (internal) */
+    stpm3x_t *dev;                  /**< device the request targets */
+    stpm3x_req_type_t type;         /**< type of request */
+    uint8_t reg;                    /**< register to write (STPM3X_REQ_WRITE) */
+    uint32_t value;                 /**< value to write (STPM3X_REQ_WRITE) */
+    stpm3x_snapshot_t *snap;        /**< snapshot to fill (STPM3X_REQ_SNAPSHOT) */
+    stpm3x_req_cb_t cb;             /**< completion callback, NULL to get a message instead */
+    void *arg;                      /**< argument of the completion callback */
+    kernel_pid_t owner;             /**< thread notified when @ref cb is NULL (internal) */
+    int res;                        /**< result of the request, STPM3X_OK on success */
+};
+
+/**
+ * @brief Request queue and worker thread of one SPI bus
+ */
+typedef struct {
+    mutex_t lock;                   /**< protects the queue */
+    stpm3x_req_t *head;             /**< first pending request */
+    stpm3x_req_t *tail;             /**< last pending request */
+    mutex_t wake;                   /**< unlocked to wake up the worker thread */
+    kernel_pid_t pid;               /**< pid of the worker thread */
+} stpm3x_async_t;
+
+/**
+ * @brief Start the worker thread serving the requests of one SPI bus
+ *
+ * @param[out] bus          Request queue to initialize
+ * @param[in]  stack        Stack of the worker thread
+ * @param[in]  stacksize    Size of @p stack
+ * @param[in]  prio         Priority of the worker thread
+ * @param[in]  name         Name of the worker thread
+ *
+ * @return                  STPM3X_ERROR if the thread could not be created
+ * @return                  STPM3X_OK on success
+ */
+int stpm3x_async_init(stpm3x_async_t *bus, char *stack, int stacksize, uint8_t prio, const char *name);
+
+/**
+ * @brief Submit a request to the queue of a SPI bus
+ *
+ * The request must stay valid until its completion callback is called or,
+ * if stpm3x_req_t::cb is NULL, until the submitting thread receives a message
+ * of type STPM3X_ASYNC_MSG_DONE with the request in `content.ptr`. This message
+ * is sent blocking: the worker waits for the submitting thread to receive it
+ * unless that thread has a message queue with room left.
+ *
+ * @param[in]  bus          Request queue of the SPI bus of stpm3x_req_t::dev
+ * @param[in]  req          Request to submit
+ *
+ * @return                  STPM3X_OK on success
+ */
+int stpm3x_async_submit(stpm3x_async_t *bus, stpm3x_req_t *req);
+/** @} */
+
+/**
+ * @name    Bus-partitioned acquisition
+ *
+ * The devices are grouped by bus, each bus gets the worker thread of an
+ * asynchronous request queue. A round submits one snapshot request per
+ * device, so the buses are read in parallel and the round lasts as long as
+ * its slowest bus. The workers merge their snapshots into one frame without
+ * lock: each one fills its own slots and the last one done closes the frame.
+ * @{
+ */
+#ifndef STPM3X_ENGINE_MAX_BUSES
+#define STPM3X_ENGINE_MAX_BUSES         (3U)    /**< Buses served by one engine */
+#endif
+#ifndef STPM3X_ENGINE_MAX_DEVS
+#define STPM3X_ENGINE_MAX_DEVS          (12U)   /**< Devices read by one engine, at most 32 */
+#endif
+#ifndef STPM3X_ENGINE_STACKSIZE
+#define STPM3X_ENGINE_STACKSIZE         (THREAD_STACKSIZE_DEFAULT) /**< Stack size of a bus worker */
+#endif
+
+/**
+ * @brief Snapshots of all devices taken in one round
+ */
+typedef struct {
+    uint32_t seq;                   /**< round number */
+    uint32_t time;                  /**< start of the round in [us] */
+    uint32_t latency;               /**< time until the last bus was done in [us] */
+    uint32_t failed;                /**< bit i set if the snapshot of device i failed */
+    stpm3x_snapshot_t snap[STPM3X_ENGINE_MAX_DEVS]; /**< snapshots, same order as the devices */
+} stpm3x_frame_t;
+
+/**
+ * @brief Acquisition engine over several buses
+ */
+typedef struct {
+    stpm3x_t *devs;                 /**< devices read by each round */
+    size_t numof;                   /**< number of devices */
+    unsigned buses;                 /**< number of buses in use */
+    uint8_t bus_of[STPM3X_ENGINE_MAX_DEVS]; /**< bus of each device */
+    stpm3x_async_t bus[STPM3X_ENGINE_MAX_BUSES]; /**< request queue of each bus */
+    char stack[STPM3X_ENGINE_MAX_BUSES][STPM3X_ENGINE_STACKSIZE]; /**< stacks of the workers */
+    stpm3x_req_t req[STPM3X_ENGINE_MAX_DEVS]; /**< snapshot request of each device */
+    stpm3x_frame_t *frame;          /**< frame of the round in progress */
+    atomic_uint pending;            /**< requests of the round not done yet */
+    atomic_uint failed;             /**< failed requests of the round */
+    mutex_t done;                   /**< unlocked when the round is done */
+    uint32_t seq;                   /**< number of rounds started */
+    stpm3x_jitter_t jitter;         /**< intervals between the starts of the rounds */
+} stpm3x_engine_t;
+
+/**
+ * @brief Group initialized devices by bus and start one worker per bus
+ *
+ * Devices share a bus when they have the same transport and the same SPI
+ * bus or UART.
+ *
+ * @param[out] engine       Engine to initialize
+ * @param[in]  devs         Initialized devices, e.g. one per entry of stpm3x_params[]
+ * @param[in]  numof        Number of devices, at most STPM3X_ENGINE_MAX_DEVS
+ * @param[in]  prio         Priority of the worker threads
+ *
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR if there are too many buses or a worker could not be created
+ */
+int stpm3x_engine_init(stpm3x_engine_t *engine, stpm3x_t *devs, size_t numof, uint8_t prio);
+
+/**
+ * @brief Read a snapshot of every device, all buses in parallel
+ *
+ * Only one round runs at a time on an engine.
+ *
+ * @param[in]  engine       Initialized engine
+ * @param[out] frame        Snapshots of the round
+ *
+ * @return                  STPM3X_OK on success
+ * @return                  STPM3X_ERROR if a snapshot failed, see stpm3x_frame_t::failed
+ */
+int stpm3x_engine_round(stpm3x_engine_t *engine, stpm3x_frame_t *frame);
+/** @} */
+
+#if defined(MODULE_SHELL) || defined(DOXYGEN)
+/**
+ * @name    Shell command
+ *
+ * `stpm3x dump|stats|bench` dumps the registers in bursts, prints the link
+ * and snapshot timing statistics of each device and measures the sustained read rate of each
+ * access mode at the bus clock in use. Built when the shell module is used;
+ * add STPM3X_SHELL_COMMAND to the command list of the application.
+ * @{
+ */
+#ifndef STPM3X_SHELL_DUMP_CHUNK
+#define STPM3X_SHELL_DUMP_CHUNK         (16U)   /**< Registers latched and read at once by `stpm3x dump` */
+#endif
+#ifndef STPM3X_SHELL_BENCH_MS
+#define STPM3X_SHELL_BENCH_MS           (1000U) /**< Default duration of each `stpm3x bench` mode in [ms] */
+#endif
+
+/**
+ * @brief Shell command entry of the driver
+ */
+#define STPM3X_SHELL_COMMAND            { "stpm3x", "STPM3x register dump, link stats and benchmark", \
+                                          stpm3x_shell_cmd }
+
+/**
+ * @brief Set the devices the shell command works on
+ *
+ * Called by the SAUL auto-initialization with its devices.
+ *
+ * @param[in]  devs         Initialized devices, the shell command refers to them by index
+ * @param[in]  numof        Number of devices
+ */
+void stpm3x_shell_init(stpm3x_t *devs, size_t numof);
+
+/**
+ * @brief Handler of the `stpm3x` shell command
+ *
+ * @param[in]  argc         Number of arguments
+ * @param[in]  argv         Arguments
+ *
+ * @return                  0 on success, 1 on error
+ */
+int stpm3x_shell_cmd(int argc, char **argv);
+/** @} */
+#endif
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2020 eeproperty Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     drivers_stpm3x
+ * @brief       Compact encoding of STPM3X sample streams
+ * @{
+ * @file
+ * @brief       Compact encoding of STPM3X sample streams
+ *
+ * Records of int32_t fields are encoded as zigzag varints of the difference
+ * with the previous record, with a full keyframe every N records so that a
+ * reader can resynchronize. Encoding writes into a caller-provided buffer,
+ * without heap. This file and stpm3x_codec.c have no RIOT dependency so the
+ * decoder can be built on the host.
+ *
+ * Record format:
+ * - header byte: bit 7 set for a keyframe, bits 0-6 the number of fields
+ * - for each field: zigzag varint of the value (keyframe) or of the
+ *   difference with the same field of the previous record (delta)
+ *
+ * @author      Joël Carron <jo.carron@cartondu.ch>
+ */
+
+#ifndef STPM3X_CODEC_H
+#define STPM3X_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef STPM3X_CODEC_FIELDS_MAX
+#define STPM3X_CODEC_FIELDS_MAX         (16U)   /**< Maximum number of fields of a record */
+#endif
+
+/**
+ * @brief Maximum size of an encoded record in bytes
+ */
+#define STPM3X_CODEC_RECORD_MAX         (1 + (5 * STPM3X_CODEC_FIELDS_MAX))
+
+/**
+ * @brief Header flag of a keyframe
+ */
+#define STPM3X_CODEC_KEYFRAME           (0x80)
+
+/**
+ * @brief Error codes
+ */
+enum {
+    STPM3X_CODEC_OK         =  0,   /**< all went as expected */
+    STPM3X_CODEC_ERR_SPACE  = -1,   /**< output buffer too small, or input record truncated */
+    STPM3X_CODEC_ERR_FORMAT = -2,   /**< invalid record, or delta record without previous keyframe */
+};
+
+/**
+ * @brief Encoder or decoder state
+ */
+typedef struct {
+    int32_t prev[STPM3X_CODEC_FIELDS_MAX]; /**< fields of the previous record */
+    uint8_t fields;                 /**< number of fields of the previous record, 0 before the first */
+    uint16_t interval;              /**< number of records between two keyframes (encoder) */
+    uint16_t since_key;             /**< number of records since the last keyframe (encoder) */
+} stpm3x_codec_t;
+
+/**
+ * @brief Initialize an encoder or a decoder
+ *
+ * @param[out] codec        State to initialize
+ * @param[in]  interval     Number of records between two keyframes, ignored by the decoder
+ */
+void stpm3x_codec_init(stpm3x_codec_t *codec, uint16_t interval);
+
+/**
+ * @brief Encode one record
+ *
+ * A keyframe is written for the first record, every @p interval records
+ * and when the number of fields changes. The state is left unchanged on error.
+ *
+ * @param[in]  enc          Encoder state
+ * @param[in]  fields       Fields of the record
+ * @param[in]  count        Number of fields, at most STPM3X_CODEC_FIELDS_MAX
+ * @param[out] buf          Output buffer
+ * @param[in]  len          Size of @p buf, STPM3X_CODEC_RECORD_MAX is always enough
+ *
+ * @return                  Number of bytes written
+ * @return                  STPM3X_CODEC_ERR_SPACE if @p buf is too small
+ */
+int stpm3x_codec_encode(stpm3x_codec_t *enc, const int32_t *fields, size_t count, uint8_t *buf, size_t len);
+
+/**
+ * @brief Decode one record
+ *
+ * @param[in]  dec          Decoder state
+ * @param[in]  buf          Encoded records
+ * @param[in]  len          Size of @p buf
+ * @param[out] fields       Fields of the record, STPM3X_CODEC_FIELDS_MAX entries
+ * @param[out] count        Number of fields decoded
+ *
+ * @return                  Number of bytes read
+ * @return                  STPM3X_CODEC_ERR_SPACE if the record is truncated
+ * @return                  STPM3X_CODEC_ERR_FORMAT if the record is invalid
+ */
+int stpm3x_codec_decode(stpm3x_codec_t *dec, const uint8_t *buf, size_t len, int32_t *fields, size_t *count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STPM3X_CODEC_H */
+/** @} */
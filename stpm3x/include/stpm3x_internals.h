@@ -86,8 +86,8 @@ extern "C" {
 #define STPM3X_MASK_SWC_THR1                          (0x3FF000)
 
 #define STPM3X_REG_DSP_CR7                            (0x0C) /* DSP control register #7 */
-#define STPM3X_MASK_CHC1                              (0xFFF)
-#define STPM3X_MASK_SWC_THR1                          (0x3FF000)
+#define STPM3X_MASK_CHV2                              (0xFFF)
+#define STPM3X_MASK_SWV_THR2                          (0x3FF000)
 #define STPM3X_MASK_SAG_THR2                          (0xFFC00000)
 
 #define STPM3X_REG_DSP_CR8                            (0x0E) /* DSP control register #8 */
@@ -267,27 +267,27 @@ extern "C" {
 #define STPM3X_MASK_EV1_V1_SAG1_EV                    (0x3C000000)
 
 #define STPM3X_REG_DSP_EV2                            (0x2C) /* DSP Live Events #2 */
-#define STPM3X_MASK_EV1_PH1PH2_POWER_SIGN_A           (0x1)
-#define STPM3X_MASK_EV1_PH1PH2_POWER_SIGN_R           (0x2)
-#define STPM3X_MASK_EV1_PH1PH2_ENERGY_OVERFLOW_A      (0x4)
-#define STPM3X_MASK_EV1_PH1PH2_ENERGY_OVERFLOW_R      (0x8)
-#define STPM3X_MASK_EV1_PH2_POWER_SIGN_A              (0x10)
-#define STPM3X_MASK_EV1_PH2_POWER_SIGN_F              (0x20)
-#define STPM3X_MASK_EV1_PH2_POWER_SIGN_R              (0x40)
-#define STPM3X_MASK_EV1_PH2_POWER_SIGN_S              (0x80)
-#define STPM3X_MASK_EV1_PH2_ENERGY_OVERFLOW_A         (0x100)
-#define STPM3X_MASK_EV1_PH2_ENERGY_OVERFLOW_F         (0x200)
-#define STPM3X_MASK_EV1_PH2_ENERGY_OVERFLOW_R         (0x400)
-#define STPM3X_MASK_EV1_PH2_ENERGY_OVERFLOW_S         (0x800)
-#define STPM3X_MASK_EV1_C2_ZCR                        (0x1000)
-#define STPM3X_MASK_EV1_C2_SIGNAL_STUCK               (0x2000)
-#define STPM3X_MASK_EV1_C2_NAH                        (0x4000)
-#define STPM3X_MASK_EV1_C2_SWC2_EV                    (0x78000)
-#define STPM3X_MASK_EV1_V2_ZCR                        (0x80000)
-#define STPM3X_MASK_EV1_V2_SIGNAL_STUCK               (0x100000)
-#define STPM3X_MASK_EV1_V2_PER_ERR                    (0x200000)
-#define STPM3X_MASK_EV1_V2_SWV2_EV                    (0x3C00000)
-#define STPM3X_MASK_EV1_V2_SAG2_EV                    (0x3C000000)
+#define STPM3X_MASK_EV2_PH1PH2_POWER_SIGN_A           (0x1)
+#define STPM3X_MASK_EV2_PH1PH2_POWER_SIGN_R           (0x2)
+#define STPM3X_MASK_EV2_PH1PH2_ENERGY_OVERFLOW_A      (0x4)
+#define STPM3X_MASK_EV2_PH1PH2_ENERGY_OVERFLOW_R      (0x8)
+#define STPM3X_MASK_EV2_PH2_POWER_SIGN_A              (0x10)
+#define STPM3X_MASK_EV2_PH2_POWER_SIGN_F              (0x20)
+#define STPM3X_MASK_EV2_PH2_POWER_SIGN_R              (0x40)
+#define STPM3X_MASK_EV2_PH2_POWER_SIGN_S              (0x80)
+#define STPM3X_MASK_EV2_PH2_ENERGY_OVERFLOW_A         (0x100)
+#define STPM3X_MASK_EV2_PH2_ENERGY_OVERFLOW_F         (0x200)
+#define STPM3X_MASK_EV2_PH2_ENERGY_OVERFLOW_R         (0x400)
+#define STPM3X_MASK_EV2_PH2_ENERGY_OVERFLOW_S         (0x800)
+#define STPM3X_MASK_EV2_C2_ZCR                        (0x1000)
+#define STPM3X_MASK_EV2_C2_SIGNAL_STUCK               (0x2000)
+#define STPM3X_MASK_EV2_C2_NAH                        (0x4000)
+#define STPM3X_MASK_EV2_C2_SWC2_EV                    (0x78000)
+#define STPM3X_MASK_EV2_V2_ZCR                        (0x80000)
+#define STPM3X_MASK_EV2_V2_SIGNAL_STUCK               (0x100000)
+#define STPM3X_MASK_EV2_V2_PER_ERR                    (0x200000)
+#define STPM3X_MASK_EV2_V2_SWV2_EV                    (0x3C00000)
+#define STPM3X_MASK_EV2_V2_SAG2_EV                    (0x3C000000)
 /** @} */
 
 /**
@@ -393,7 +393,7 @@ extern "C" {
 #define STPM3X_MASK_PH2_REACTIVE_ENERGY               (0xFFFFFFFF)
 
 #define STPM3X_REG_PH2_REG4                           (0x72) /* PH2 Apparent Energy */
-#define STPM3X_MASK_PH2_REACTIVE_ENERGY               (0xFFFFFFFF)
+#define STPM3X_MASK_PH2_APPARENT_ENERGY               (0xFFFFFFFF)
 
 #define STPM3X_REG_PH2_REG5                           (0x74) /* PH2 Active Power */
 #define STPM3X_MASK_PH2_ACTIVE_POWER                  (0x1FFFFFFF)
@@ -458,6 +458,29 @@ extern "C" {
 #define STPM3X_T_SCS_CUST           (50U)
 #define STPM3X_T_SCS_TYP            (1000U)
 
+/**
+  * @brief   LSB of the period registers in [us]
+  *
+  * From Datasheet p.95
+  */
+#define STPM3X_PERIOD_LSB_US        (8U)
+
+/**
+  * @brief   LSB of the sag time threshold of DSP_CR3 in [us]
+  */
+#define STPM3X_SAG_TIME_THR_LSB_US  (8U)
+
+/**
+  * @brief   LSB of the sag and swell durations of DSP_REG16 to DSP_REG19 in [us]
+  */
+#define STPM3X_EVENT_TIME_LSB_US    (8000U)
+
+/**
+  * @brief   Sag and swell thresholds are compared with the 10 MSB of the RMS values
+  */
+#define STPM3X_THR_V_SHIFT          (5U)
+#define STPM3X_THR_C_SHIFT          (7U)
+
 /**
   * @brief   Constants for CRC generation
   *
@@ -466,6 +489,14 @@ extern "C" {
 #define STPM3X_CRC_8                (0x07)
 #define STPM3X_FRAME_LEN            (5U)
 
+/**
+  * @brief   UART baud rate, US_REG2 BAUD_RATE = STPM3X_UART_CLK / baud rate
+  *
+  * From Datasheet, US_REG2 p.77
+  */
+#define STPM3X_UART_CLK             (16000000UL)
+#define STPM3X_UART_BAUD_RESET      (9600UL)
+
 /**
   * @brief   Size of data to write in the SPI bus
   *
@@ -474,6 +505,19 @@ extern "C" {
 #define STPM3X_DATA_SIZE            (10U)
 #define STPM3X_DATA_SIZE_STEP       (STPM3X_DATA_SIZE / 2)
 
+#ifdef MODULE_MTD
+#include "mtd.h"
+
+/**
+  * @brief   Write to an MTD device without crossing its page boundaries
+  *
+  * Shared by the trace export and the calibration records.
+  *
+  * @return  STPM3X_OK on success, STPM3X_ERROR on MTD error
+  */
+int stpm3x_mtd_write(mtd_dev_t *mtd, uint32_t addr, const void *data, uint32_t len);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2020 eeproperty Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     drivers_stpm3x
+ * @brief       Integer math helpers of the STPM3X driver
+ * @{
+ * @file
+ * @brief       Integer math helpers of the STPM3X driver
+ *
+ * These helpers avoid any dependency on libm and floating point.
+ *
+ * @author      Joel Carron <jo.carron@cartondu.ch>
+ */
+
+#ifndef STPM3X_MATH_H
+#define STPM3X_MATH_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Quarter of a turn in [1/2^32 turn]
+ */
+#define STPM3X_ANGLE_QUARTER        (1UL << 30)
+
+/**
+ * @brief Cosine of an angle, from a polynomial approximation
+ *
+ * The absolute error is below 1e-8, precise enough for filter coefficients.
+ *
+ * @param[in]  angle        Angle in [1/2^32 turn]
+ *
+ * @return                  Cosine in Q30 format
+ */
+int32_t stpm3x_cos_q30(uint32_t angle);
+
+/**
+ * @brief Cosine of an angle, interpolated in a table of a quarter turn
+ *
+ * The absolute error is below 2e-4, cheaper than stpm3x_cos_q30() for values
+ * such as power factors.
+ *
+ * @param[in]  angle        Angle in [1/2^32 turn]
+ *
+ * @return                  Cosine in Q15 format, saturated to 32767
+ */
+int16_t stpm3x_cos_q15(uint32_t angle);
+
+/**
+ * @brief Integer square root
+ *
+ * @param[in]  value        Value to compute the square root of
+ *
+ * @return                  Floor of the square root of @p value
+ */
+uint32_t stpm3x_isqrt(uint64_t value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STPM3X_MATH_H */
+/** @} */
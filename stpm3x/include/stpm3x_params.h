@@ -37,12 +37,33 @@ extern "C" {
  * @name    Set default configuration parameters for the STPM3X
  * @{
  */
+#ifndef STPM3X_PARAM_TRANSPORT
+#define STPM3X_PARAM_TRANSPORT                        (NULL)                /**< &stpm3x_transport_uart for UART */
+#endif
 #ifndef STPM3X_PARAM_SPI
 #define STPM3X_PARAM_SPI                              (SPI_DEV(0))
 #endif
 #ifndef STPM3X_PARAM_SPI_CLK
 #define STPM3X_PARAM_SPI_CLK                          (SPI_CLK_5MHZ)
 #endif
+#ifndef STPM3X_PARAM_UART
+#define STPM3X_PARAM_UART                             (UART_DEV(1))
+#endif
+#ifndef STPM3X_PARAM_BAUDRATE
+#define STPM3X_PARAM_BAUDRATE                         (STPM3X_UART_BAUD_MAX)
+#endif
+#ifndef STPM3X_PARAM_TRACE
+#define STPM3X_PARAM_TRACE                            (NULL)                /**< Frame trace, with stpm3x_trace */
+#endif
+#ifndef STPM3X_PARAM_TRACE_ID
+#define STPM3X_PARAM_TRACE_ID                         (0)
+#endif
+#ifndef STPM3X_PARAM_CALIB_MTD
+#define STPM3X_PARAM_CALIB_MTD                        (NULL)                /**< Calibration record storage, with stpm3x_calib */
+#endif
+#ifndef STPM3X_PARAM_CALIB_ADDR
+#define STPM3X_PARAM_CALIB_ADDR                       (0)
+#endif
 #ifndef STPM3X_PARAM_SCS
 #define STPM3X_PARAM_SCS                              (GPIO_PIN(0, 0))
 #endif
@@ -64,14 +85,48 @@ extern "C" {
 #ifndef STPM3X_PARAM_VOLTAGELSB
 #define STPM3X_PARAM_VOLTAGELSB                       (1)                   /**< Calculated with formula in Table 15 p.52 of Datasheet */
 #endif
+#ifndef STPM3X_PARAM_POWERLSB
+#define STPM3X_PARAM_POWERLSB                         (1)                   /**< Calculated with formula in Table 15 p.52 of Datasheet */
+#endif
+#ifndef STPM3X_PARAM_ENERGYLSB
+#define STPM3X_PARAM_ENERGYLSB                        (0.001)               /**< Calculated with formula in Table 15 p.52 of Datasheet */
+#endif
+#ifndef STPM3X_PARAM_CHARGELSB
+#define STPM3X_PARAM_CHARGELSB                        (0.001)               /**< Current LSB times the accumulation period of AH_ACC */
+#endif
 #ifndef STPM3X_PARAM_GAIN
 #define STPM3X_PARAM_GAIN                             (2)                   /**< Values : 2, 4, 8 or 16 */
 #endif
 
+#ifdef MODULE_PERIPH_UART
+#define STPM3X_PARAMS_UART                            .uart   = STPM3X_PARAM_UART,        \
+                                                      .baudrate = STPM3X_PARAM_BAUDRATE,
+#else
+#define STPM3X_PARAMS_UART
+#endif
+
+#if IS_USED(MODULE_STPM3X_TRACE)
+#define STPM3X_PARAMS_TRACE                           .trace  = STPM3X_PARAM_TRACE,       \
+                                                      .trace_id = STPM3X_PARAM_TRACE_ID,
+#else
+#define STPM3X_PARAMS_TRACE
+#endif
+
+#if IS_USED(MODULE_STPM3X_CALIB) && defined(MODULE_MTD)
+#define STPM3X_PARAMS_CALIB                           .calib_mtd = STPM3X_PARAM_CALIB_MTD, \
+                                                      .calib_addr = STPM3X_PARAM_CALIB_ADDR,
+#else
+#define STPM3X_PARAMS_CALIB
+#endif
+
 #ifndef STPM3X_PARAMS_DEFAULT
 #define STPM3X_PARAMS_DEFAULT                         {                                     \
+                                                        .transport = STPM3X_PARAM_TRANSPORT, \
                                                         .spi    = STPM3X_PARAM_SPI,         \
                                                         .sclk   = STPM3X_PARAM_SPI_CLK,     \
+                                                        STPM3X_PARAMS_UART                  \
+                                                        STPM3X_PARAMS_TRACE                 \
+                                                        STPM3X_PARAMS_CALIB                 \
                                                         .scs    = STPM3X_PARAM_SCS,         \
                                                         .syn    = STPM3X_PARAM_SYN,         \
                                                         .int1   = STPM3X_PARAM_INT1,        \
@@ -79,6 +134,9 @@ extern "C" {
                                                         .en   = STPM3X_PARAM_EN,            \
                                                         .currentRMSLSBValue = STPM3X_PARAM_CURRENTLSB, \
                                                         .voltageRMSLSBValue = STPM3X_PARAM_VOLTAGELSB, \
+                                                        .powerLSBValue = STPM3X_PARAM_POWERLSB, \
+                                                        .energyLSBValue = STPM3X_PARAM_ENERGYLSB, \
+                                                        .chargeLSBValue = STPM3X_PARAM_CHARGELSB, \
                                                         .gain = STPM3X_PARAM_GAIN \
                                                       }
 #endif
@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2020 eeproperty Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     drivers_stpm3x
+ * @brief       Field map of the data registers of the STPM3X
+ * @{
+ * @file
+ * @brief       Field map of the data registers of the STPM3X
+ *
+ * Each field of @ref STPM3X_FIELDS gives rise to an index STPM3X_FIELD_<name>,
+ * an entry of @ref stpm3x_fields and an accessor stpm3x_get_<name>().
+ * The shift and the width of a field are derived from its mask, so that an
+ * accessor compiles down to a constant mask and shift.
+ *
+ * @author      Joel Carron <jo.carron@cartondu.ch>
+ */
+
+#ifndef STPM3X_REGMAP_H
+#define STPM3X_REGMAP_H
+
+#include <stdint.h>
+
+#include "stpm3x_internals.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief LSB unit of a field
+ */
+typedef enum {
+    STPM3X_UNIT_RAW = 0,            /**< no physical unit */
+    STPM3X_UNIT_PERIOD,             /**< STPM3X_PERIOD_LSB_US */
+    STPM3X_UNIT_EVENT,              /**< STPM3X_EVENT_TIME_LSB_US */
+    STPM3X_UNIT_VOLTAGE,            /**< stpm3x_lsb_t::voltage */
+    STPM3X_UNIT_CURRENT,            /**< stpm3x_lsb_t::current of the channel */
+    STPM3X_UNIT_POWER,              /**< stpm3x_lsb_t::power of the channel */
+    STPM3X_UNIT_ENERGY,             /**< stpm3x_lsb_t::energy of the channel */
+    STPM3X_UNIT_CHARGE,             /**< stpm3x_lsb_t::charge of the channel */
+} stpm3x_unit_t;
+
+/**
+ * @brief Fields of the data registers, datasheet p.95-99
+ *
+ * X(name, register, mask, signed, unit, channel), the total energies use
+ * the LSB of channel 1.
+ */
+#define STPM3X_FIELDS(X) \
+    X(PH1_PERIOD,                       STPM3X_REG_DSP_REG1,  STPM3X_MASK_PH1_PERIOD,                       0, STPM3X_UNIT_PERIOD,  0) \
+    X(PH2_PERIOD,                       STPM3X_REG_DSP_REG1,  STPM3X_MASK_PH2_PERIOD,                       0, STPM3X_UNIT_PERIOD,  1) \
+    X(V1_DATA,                          STPM3X_REG_DSP_REG2,  STPM3X_MASK_V1_DATA,                          1, STPM3X_UNIT_RAW,     0) \
+    X(C1_DATA,                          STPM3X_REG_DSP_REG3,  STPM3X_MASK_C1_DATA,                          1, STPM3X_UNIT_RAW,     0) \
+    X(V2_DATA,                          STPM3X_REG_DSP_REG4,  STPM3X_MASK_V2_DATA,                          1, STPM3X_UNIT_RAW,     1) \
+    X(C2_DATA,                          STPM3X_REG_DSP_REG5,  STPM3X_MASK_C2_DATA,                          1, STPM3X_UNIT_RAW,     1) \
+    X(V1_FUND,                          STPM3X_REG_DSP_REG6,  STPM3X_MASK_V1_FUND,                          1, STPM3X_UNIT_RAW,     0) \
+    X(C1_FUND,                          STPM3X_REG_DSP_REG7,  STPM3X_MASK_C1_FUND,                          1, STPM3X_UNIT_RAW,     0) \
+    X(V2_FUND,                          STPM3X_REG_DSP_REG8,  STPM3X_MASK_V2_FUND,                          1, STPM3X_UNIT_RAW,     1) \
+    X(C2_FUND,                          STPM3X_REG_DSP_REG9,  STPM3X_MASK_C2_FUND,                          1, STPM3X_UNIT_RAW,     1) \
+    X(V1_RMS,                           STPM3X_REG_DSP_REG14, STPM3X_MASK_V1_RMS_DATA,                      0, STPM3X_UNIT_VOLTAGE, 0) \
+    X(C1_RMS,                           STPM3X_REG_DSP_REG14, STPM3X_MASK_C1_RMS_DATA,                      0, STPM3X_UNIT_CURRENT, 0) \
+    X(V2_RMS,                           STPM3X_REG_DSP_REG15, STPM3X_MASK_V2_RMS_DATA,                      0, STPM3X_UNIT_VOLTAGE, 1) \
+    X(C2_RMS,                           STPM3X_REG_DSP_REG15, STPM3X_MASK_C2_RMS_DATA,                      0, STPM3X_UNIT_CURRENT, 1) \
+    X(SWV1_TIME,                        STPM3X_REG_DSP_REG16, STPM3X_MASK_SWV1_TIME,                        0, STPM3X_UNIT_EVENT,   0) \
+    X(SAG1_TIME,                        STPM3X_REG_DSP_REG16, STPM3X_MASK_SAG1_TIME,                        0, STPM3X_UNIT_EVENT,   0) \
+    X(SWC1_TIME,                        STPM3X_REG_DSP_REG17, STPM3X_MASK_SWC1_TIME,                        0, STPM3X_UNIT_EVENT,   0) \
+    X(C1_PHA,                           STPM3X_REG_DSP_REG17, STPM3X_MASK_C1_PHA,                           0, STPM3X_UNIT_PERIOD,  0) \
+    X(SWV2_TIME,                        STPM3X_REG_DSP_REG18, STPM3X_MASK_SWV2_TIME,                        0, STPM3X_UNIT_EVENT,   1) \
+    X(SAG2_TIME,                        STPM3X_REG_DSP_REG18, STPM3X_MASK_SAG2_TIME,                        0, STPM3X_UNIT_EVENT,   1) \
+    X(SWC2_TIME,                        STPM3X_REG_DSP_REG19, STPM3X_MASK_SWC2_TIME,                        0, STPM3X_UNIT_EVENT,   1) \
+    X(C2_PHA,                           STPM3X_REG_DSP_REG19, STPM3X_MASK_C2_PHA,                           0, STPM3X_UNIT_PERIOD,  1) \
+    X(PH1_ACTIVE_ENERGY,                STPM3X_REG_PH1_REG1,  STPM3X_MASK_PH1_ACTIVE_ENERGY,                1, STPM3X_UNIT_ENERGY,  0) \
+    X(PH1_FUNDAMENTAL_ENERGY,           STPM3X_REG_PH1_REG2,  STPM3X_MASK_PH1_FUNDAMENTAL_ENERGY,           1, STPM3X_UNIT_ENERGY,  0) \
+    X(PH1_REACTIVE_ENERGY,              STPM3X_REG_PH1_REG3,  STPM3X_MASK_PH1_REACTIVE_ENERGY,              1, STPM3X_UNIT_ENERGY,  0) \
+    X(PH1_APPARENT_ENERGY,              STPM3X_REG_PH1_REG4,  STPM3X_MASK_PH1_APPARENT_ENERGY,              1, STPM3X_UNIT_ENERGY,  0) \
+    X(PH1_ACTIVE_POWER,                 STPM3X_REG_PH1_REG5,  STPM3X_MASK_PH1_ACTIVE_POWER,                 1, STPM3X_UNIT_POWER,   0) \
+    X(PH1_FUNDAMENTAL_POWER,            STPM3X_REG_PH1_REG6,  STPM3X_MASK_PH1_FUNDAMENTAL_POWER,            1, STPM3X_UNIT_POWER,   0) \
+    X(PH1_REACTIVE_POWER,               STPM3X_REG_PH1_REG7,  STPM3X_MASK_PH1_REACTIVE_POWER,               1, STPM3X_UNIT_POWER,   0) \
+    X(PH1_APPARENT_RMS_POWER,           STPM3X_REG_PH1_REG8,  STPM3X_MASK_PH1_APPARENT_RMS_POWER,           0, STPM3X_UNIT_POWER,   0) \
+    X(PH1_APPARENT_VECTORIAL_POWER,     STPM3X_REG_PH1_REG9,  STPM3X_MASK_PH1_APPARENT_VECTORIAL_POWER,     0, STPM3X_UNIT_POWER,   0) \
+    X(PH1_MOMENTARY_ACTIVE_POWER,       STPM3X_REG_PH1_REG10, STPM3X_MASK_PH1_MOMENTARY_ACTIVE_POWER,       1, STPM3X_UNIT_POWER,   0) \
+    X(PH1_MOMENTARY_FUNDAMENTAL_POWER,  STPM3X_REG_PH1_REG11, STPM3X_MASK_PH1_MOMENTARY_FUNDAMENTAL_POWER,  1, STPM3X_UNIT_POWER,   0) \
+    X(PH1_AH_ACC,                       STPM3X_REG_PH1_REG12, STPM3X_MASK_PH1_AH_ACC,                       1, STPM3X_UNIT_CHARGE,  0) \
+    X(PH2_ACTIVE_ENERGY,                STPM3X_REG_PH2_REG1,  STPM3X_MASK_PH2_ACTIVE_ENERGY,                1, STPM3X_UNIT_ENERGY,  1) \
+    X(PH2_FUNDAMENTAL_ENERGY,           STPM3X_REG_PH2_REG2,  STPM3X_MASK_PH2_FUNDAMENTAL_ENERGY,           1, STPM3X_UNIT_ENERGY,  1) \
+    X(PH2_REACTIVE_ENERGY,              STPM3X_REG_PH2_REG3,  STPM3X_MASK_PH2_REACTIVE_ENERGY,              1, STPM3X_UNIT_ENERGY,  1) \
+    X(PH2_APPARENT_ENERGY,              STPM3X_REG_PH2_REG4,  STPM3X_MASK_PH2_APPARENT_ENERGY,              1, STPM3X_UNIT_ENERGY,  1) \
+    X(PH2_ACTIVE_POWER,                 STPM3X_REG_PH2_REG5,  STPM3X_MASK_PH2_ACTIVE_POWER,                 1, STPM3X_UNIT_POWER,   1) \
+    X(PH2_FUNDAMENTAL_POWER,            STPM3X_REG_PH2_REG6,  STPM3X_MASK_PH2_FUNDAMENTAL_POWER,            1, STPM3X_UNIT_POWER,   1) \
+    X(PH2_REACTIVE_POWER,               STPM3X_REG_PH2_REG7,  STPM3X_MASK_PH2_REACTIVE_POWER,               1, STPM3X_UNIT_POWER,   1) \
+    X(PH2_APPARENT_RMS_POWER,           STPM3X_REG_PH2_REG8,  STPM3X_MASK_PH2_APPARENT_RMS_POWER,           0, STPM3X_UNIT_POWER,   1) \
+    X(PH2_APPARENT_VECTORIAL_POWER,     STPM3X_REG_PH2_REG9,  STPM3X_MASK_PH2_APPARENT_VECTORIAL_POWER,     0, STPM3X_UNIT_POWER,   1) \
+    X(PH2_MOMENTARY_ACTIVE_POWER,       STPM3X_REG_PH2_REG10, STPM3X_MASK_PH2_MOMENTARY_ACTIVE_POWER,       1, STPM3X_UNIT_POWER,   1) \
+    X(PH2_MOMENTARY_FUNDAMENTAL_POWER,  STPM3X_REG_PH2_REG11, STPM3X_MASK_PH2_MOMENTARY_FUNDAMENTAL_POWER,  1, STPM3X_UNIT_POWER,   1) \
+    X(PH2_AH_ACC,                       STPM3X_REG_PH2_REG12, STPM3X_MASK_PH2_AH_ACC,                       1, STPM3X_UNIT_CHARGE,  1) \
+    X(TOT_ACTIVE_ENERGY,                STPM3X_REG_TOT_ACTIVE_ENERGY,      STPM3X_MASK_TOT_ACTIVE_ENERGY,      1, STPM3X_UNIT_ENERGY, 0) \
+    X(TOT_FUNDAMENTAL_ENERGY,           STPM3X_REG_TOT_FUNDAMENTAL_ENERGY, STPM3X_MASK_TOT_FUNDAMENTAL_ENERGY, 1, STPM3X_UNIT_ENERGY, 0) \
+    X(TOT_REACTIVE_ENERGY,              STPM3X_REG_TOT_REACTIVE_ENERGY,    STPM3X_MASK_TOT_REACTIVE_ENERGY,    1, STPM3X_UNIT_ENERGY, 0) \
+    X(TOT_APPARENT_ENERGY,              STPM3X_REG_TOT_APPARENT_ENERGY,    STPM3X_MASK_TOT_APPARENT_ENERGY,    1, STPM3X_UNIT_ENERGY, 0)
+
+/**
+ * @brief Index of the fields, STPM3X_FIELD_<name>
+ */
+enum {
+#define STPM3X_FIELD_ENUM(name, reg, mask, sign, unit, ch)      STPM3X_FIELD_##name,
+    STPM3X_FIELDS(STPM3X_FIELD_ENUM)
+#undef STPM3X_FIELD_ENUM
+    STPM3X_FIELD_NUMOF              /**< number of fields */
+};
+
+/**
+ * @brief Description of a field
+ */
+typedef struct {
+    uint32_t mask;                  /**< mask of the field in its register */
+    uint8_t reg;                    /**< address of the register */
+    uint8_t sign;                   /**< 1 for a two's complement field */
+    uint8_t unit;                   /**< LSB unit, see stpm3x_unit_t */
+    uint8_t channel;                /**< channel of the LSB, 0 or 1 */
+} stpm3x_field_t;
+
+/**
+ * @brief Descriptions of the fields, indexed by STPM3X_FIELD_<name>
+ */
+extern const stpm3x_field_t stpm3x_fields[STPM3X_FIELD_NUMOF];
+
+/**
+ * @brief Extract a field from a register value
+ *
+ * @param[in]  value        Register value
+ * @param[in]  mask         Mask of the field, not 0
+ * @param[in]  sign         Sign-extend the field
+ *
+ * @return                  Value of the field
+ */
+static inline int32_t stpm3x_field_extract(uint32_t value, uint32_t mask, unsigned sign)
+{
+    if (sign)
+    {
+        // the MSB of the field goes to the MSB of the word before the arithmetic shift
+        return (int32_t)((value & mask) << __builtin_clz(mask)) >> (__builtin_clz(mask) + __builtin_ctz(mask));
+    }
+
+    return (value & mask) >> __builtin_ctz(mask);
+}
+
+/**
+ * @brief Accessors stpm3x_get_<name>() of the fields
+ */
+#define STPM3X_FIELD_GETTER(name, reg, mask, sign, unit, ch)    \
+    static inline int32_t stpm3x_get_##name(uint32_t value)     \
+    {                                                           \
+        return stpm3x_field_extract(value, (mask), (sign));     \
+    }
+STPM3X_FIELDS(STPM3X_FIELD_GETTER)
+#undef STPM3X_FIELD_GETTER
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STPM3X_REGMAP_H */
+/** @} */
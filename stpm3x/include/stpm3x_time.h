@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2020 eeproperty Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     drivers_stpm3x
+ * @brief       Timebase of the STPM3X driver
+ * @{
+ * @file
+ * @brief       Timebase of the STPM3X driver
+ *
+ * All the timestamps, delays and timeouts of the driver go through these
+ * helpers: they use the ztimer_usec clock when the application uses it and
+ * fall back to xtimer otherwise. The times are in [us] in both cases.
+ *
+ * @author      Joel Carron <jo.carron@cartondu.ch>
+ */
+
+#ifndef STPM3X_TIME_H
+#define STPM3X_TIME_H
+
+#include <stdint.h>
+
+#include "kernel_defines.h"
+#include "mutex.h"
+
+#if IS_USED(MODULE_ZTIMER_USEC)
+#include "ztimer.h"
+#else
+#include "xtimer.h"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Current time
+ *
+ * @return                  Time in [us], wraps after about 71 minutes
+ */
+static inline uint32_t stpm3x_time_now(void)
+{
+#if IS_USED(MODULE_ZTIMER_USEC)
+    return ztimer_now(ZTIMER_USEC);
+#else
+    return xtimer_now_usec();
+#endif
+}
+
+/**
+ * @brief Block the calling thread
+ *
+ * @param[in]  us           Delay in [us]
+ */
+static inline void stpm3x_time_sleep(uint32_t us)
+{
+#if IS_USED(MODULE_ZTIMER_USEC)
+    ztimer_sleep(ZTIMER_USEC, us);
+#else
+    xtimer_usleep(us);
+#endif
+}
+
+/**
+ * @brief Block the calling thread until @p period after the last wake-up
+ *
+ * Unlike successive sleeps, the wake-ups do not drift with the time spent
+ * between them.
+ *
+ * @param[inout] last       Time of the last wake-up in [us], updated
+ * @param[in]    period     Period in [us]
+ */
+static inline void stpm3x_time_periodic_wakeup(uint32_t *last, uint32_t period)
+{
+#if IS_USED(MODULE_ZTIMER_USEC)
+    ztimer_periodic_wakeup(ZTIMER_USEC, last, period);
+#else
+    xtimer_ticks32_t ticks = xtimer_ticks_from_usec(*last);
+
+    xtimer_periodic_wakeup(&ticks, period);
+    *last = xtimer_usec_from_ticks(ticks);
+#endif
+}
+
+/**
+ * @brief Current time on 64 bits
+ *
+ * With ztimer the 32 bits clock is extended in software. The first call arms
+ * a timer which reads the clock twice per wrap, so that no wrap is missed
+ * however rarely this function is called.
+ *
+ * @return                  Time in [us]
+ */
+uint64_t stpm3x_time_now64(void);
+
+/**
+ * @brief Block the calling thread for a delay beyond the 32 bits range
+ *
+ * @param[in]  us           Delay in [us]
+ */
+void stpm3x_time_sleep64(uint64_t us);
+
+/**
+ * @brief Lock a mutex, giving up after a timeout
+ *
+ * With ztimer the timeout unlocks the mutex itself: a timeout racing with a
+ * regular unlock is reported as a timeout and the mutex is left unlocked, as
+ * after an unlock arriving late. Only use it on mutexes used as signals.
+ *
+ * @param[in]  mutex        Mutex to lock
+ * @param[in]  timeout      Timeout in [us]
+ *
+ * @return                  0 when the mutex was locked
+ * @return                  -1 on timeout
+ */
+int stpm3x_time_lock_timeout(mutex_t *mutex, uint32_t timeout);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STPM3X_TIME_H */
+/** @} */
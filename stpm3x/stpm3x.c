@@ -14,7 +14,7 @@
  * @file
  * @brief       Driver for the ST STPM33 made for measurement of power and energy.
  *              You can adapt this driver to make it work with other STPM3x chips in the serie (32/34)
- *              Only SPI communication is implemented. The chips support UART too but it's not supported by this driver.
+ *              The frames go through the SPI or UART transport of the device, see stpm3x_transport.c.
  *              S/W Latch 1&2 (DSP_REG3, bit 21+22) are used to retrieve physical values. Other modes have to be implemented if needed.
  *              The driver only allow to read voltages and currents measured on channels 1&2. All others physical values have to be implemented if needed.
  *
@@ -29,18 +29,26 @@
 #include <string.h>
 
 #include "assert.h"
+#include "kernel_defines.h"
 #include "periph/spi.h"
 #include "periph/gpio.h"
-#include "xtimer.h"
 
 #include "stpm3x.h"
 #include "stpm3x_internals.h"
+#include "stpm3x_math.h"
 #include "stpm3x_params.h"
+#include "stpm3x_regmap.h"
+#include "stpm3x_time.h"
 
 #define ENABLE_DEBUG    (DEBUG_MODE)
 #include "debug.h"
 
-#if ENABLE_DEBUG==1
+/*
+ * Error interrupts of the debug mode, they need the INT1/INT2 pins of stpm3x_irq
+ */
+#define DEBUG_IRQ       (ENABLE_DEBUG && IS_USED(MODULE_STPM3X_IRQ))
+
+#if DEBUG_IRQ
 struct irq_callback_args
 {
     char *name;
@@ -48,29 +56,78 @@ struct irq_callback_args
 };
 #endif
 
-/* 
- * Internal function prototypes
- * Two functions taken from user manuel from ST "UM2066"- "Getting started with the STPM3x"
- */
-static uint8_t _spi_calc_crc8(uint8_t *buf);
-static void _spi_crc8_calc(uint8_t data, uint8_t *crc_checksum);
-
-#if ENABLE_DEBUG==1
+#if DEBUG_IRQ
 static void _stpm3x_spi_error_cb(void *arg);
 #endif
 
+/**
+ * @brief SPI clocks tried by the link training, slowest first
+ */
+static const spi_clk_t _spi_clks[] = {
+    SPI_CLK_100KHZ, SPI_CLK_400KHZ, SPI_CLK_1MHZ, SPI_CLK_5MHZ, SPI_CLK_10MHZ
+};
+
+/*
+ * Reset values of the configuration registers, indexed by address / 2
+ */
+static const uint32_t _reset_values[STPM3X_SHADOW_NUMOF] = {
+    0x040000A0, 0x240000A0, 0x000004E0, 0x00000000, // DSP_CR1 - DSP_CR4
+    0x003FF800, 0x003FF800, 0x003FF800, 0x003FF800, // DSP_CR5 - DSP_CR8
+    0x00000FFF, 0x00000FFF, 0x00000FFF, 0x00000FFF, // DSP_CR9 - DSP_CR12
+    0x03270327, 0x03270327,                         // DFE_CR1 - DFE_CR2
+    0x00000000, 0x00000000,                         // DSP_IRQ1 - DSP_IRQ2
+    0x00000000, 0x00000000,                         // DSP_SR1 - DSP_SR2, never restored
+    0x00004007, 0x00000683, 0x00000000,             // US_REG1 - US_REG3
+};
+
+/**
+ * @brief Self-clearing command bits of DSP_CR3, not kept in the shadow
+ */
+#define STPM3X_CR3_COMMANDS     (STPM3X_MASK_SW_RESET | STPM3X_MASK_SW_LATCH1 | STPM3X_MASK_SW_LATCH2)
+
 uint8_t stpm3x_init(stpm3x_t *dev, const stpm3x_params_t *params)
 {
     assert(dev && params);
 
     dev->params = *params;
+    dev->transport = (params->transport) ? params->transport : &stpm3x_transport_spi;
+    // LSB values of the parameters are in [mV], [mA] and [mW]
+    dev->lsb.voltage = dev->params.voltageRMSLSBValue * 1000000;
+    for (unsigned i = 0; i < STPM3X_CHANNELS; i++)
+    {
+        dev->lsb.current[i] = dev->params.currentRMSLSBValue * 1000000;
+#if IS_USED(MODULE_STPM3X_POWER)
+        dev->lsb.power[i] = dev->params.powerLSBValue * 1000000;
+#endif
+#if IS_USED(MODULE_STPM3X_ENERGY)
+        // [mWh] and [mAh] to [pWh] and [pAh]
+        dev->lsb.energy[i] = dev->params.energyLSBValue * 1000000000;
+        dev->lsb.charge[i] = dev->params.chargeLSBValue * 1000000000;
+#endif
+    }
+    mutex_init(&dev->lock);
+    dev->snap_gen = 0;
+    dev->snap_begin = 0;
+    dev->snap_res = STPM3X_OK;
+    // the slots of the features compiled out are never read
+    memset(&dev->snap, 0, sizeof(dev->snap));
+    stpm3x_jitter_reset(&dev->jitter);
+    dev->live.seq = 0;
+    memcpy(dev->shadow, _reset_values, sizeof(dev->shadow));
+    dev->ranging = 0;
+    memset(&dev->link, 0, sizeof(dev->link));
+    dev->link.clk = UINT8_MAX;
+
+    for (unsigned i = 0; (i < ARRAY_SIZE(_spi_clks)) && (dev->transport == &stpm3x_transport_spi); i++)
+    {
+        dev->link.clk = (_spi_clks[i] == dev->params.sclk) ? i : dev->link.clk;
+    }
 
     gpio_init(STPM3X_PARAM_SYN, GPIO_OUT);
     gpio_init(STPM3X_PARAM_EN, GPIO_OUT);
 
-    if (spi_init_cs(dev->params.spi, dev->params.scs) != SPI_OK)
+    if (dev->transport->init(dev) != STPM3X_OK)
     {
-        DEBUG("%s : error while initializing CS pin\n", DEBUG_FUNC);
         return STPM3X_ERROR;
     }
 
@@ -100,8 +157,14 @@ uint8_t stpm3x_init(stpm3x_t *dev, const stpm3x_params_t *params)
             gain = 0x3270327; // default value for gain = 2
     }
 
+    // the LSB values of the parameters are given for the initial gain
+    for (unsigned i = 0; i < STPM3X_CHANNELS; i++)
+    {
+        dev->gain[i] = 2 << ((gain & STPM3X_MASK_GAIN1) >> 26);
+    }
+
     // init of registers
-#if ENABLE_DEBUG==1
+#if DEBUG_IRQ
     uint32_t row14 = 0xFFFFFFFF; // Activate all physical values error interrupts on INT1
     stpm3x_write_reg(dev, STPM3X_REG_DSP_IRQ1, &row14);
     uint32_t row15 = 0xFFFFFFFF; // Activate all physical values error interrupts on INT2
@@ -110,9 +173,14 @@ uint8_t stpm3x_init(stpm3x_t *dev, const stpm3x_params_t *params)
     stpm3x_write_reg(dev, STPM3X_REG_US_REG3, &row20);
 #endif
     uint32_t row18 = 0x00504007; // Default value + 80ms SPI timeout
-    stpm3x_write_reg(dev, STPM3X_REG_US_REG1, &row18);
-    stpm3x_write_reg(dev, STPM3X_REG_DFE_CR1, &gain); // same gain on both channels
-    stpm3x_write_reg(dev, STPM3X_REG_DFE_CR2, &gain);
+    // same gain on both channels
+    if ((stpm3x_write_reg(dev, STPM3X_REG_US_REG1, &row18) != STPM3X_OK)
+        || (stpm3x_write_reg(dev, STPM3X_REG_DFE_CR1, &gain) != STPM3X_OK)
+        || (stpm3x_write_reg(dev, STPM3X_REG_DFE_CR2, &gain) != STPM3X_OK))
+    {
+        DEBUG("%s : could not write the configuration\n", DEBUG_FUNC);
+        return STPM3X_ERROR;
+    }
 
     uint32_t test_value = 0;
     stpm3x_read_reg(dev, STPM3X_REG_US_REG1, &test_value);
@@ -123,7 +191,22 @@ uint8_t stpm3x_init(stpm3x_t *dev, const stpm3x_params_t *params)
         return STPM3X_ERROR;
     }
 
-#if ENABLE_DEBUG==1
+#if STPM3X_LINK_TRAINING
+    if (dev->transport->negotiate)
+    {
+        dev->transport->negotiate(dev);
+    }
+#endif
+
+#if IS_USED(MODULE_STPM3X_CALIB) && defined(MODULE_MTD)
+    // without a valid record the device still measures, uncalibrated
+    if (dev->params.calib_mtd)
+    {
+        stpm3x_calib_load(dev, dev->params.calib_mtd, dev->params.calib_addr);
+    }
+#endif
+
+#if DEBUG_IRQ
     // We must configure the interrupt pins after initialising registers related to the interrupts.
     // Otherwise we get spammed with false positive errors (infinite interrupts triggered).
     DEBUG("%s : Debug mode enabled on STPM3X driver\n", DEBUG_FUNC);
@@ -158,17 +241,17 @@ uint8_t stpm3x_init(stpm3x_t *dev, const stpm3x_params_t *params)
 void stpm3x_lock_spi_interface(stpm3x_t *dev)
 {
     gpio_clear(dev->params.en);
-    gpio_clear(dev->params.scs);
-    xtimer_usleep(STPM3X_T_SCS_CUST);
+    gpio_write(dev->params.scs, dev->transport->scs_level);
+    stpm3x_time_sleep(STPM3X_T_SCS_CUST);
 
     gpio_set(dev->params.syn);
     gpio_set(dev->params.en);
 
-    xtimer_usleep(STPM3X_T_STARTUP_TYP);
+    stpm3x_time_sleep(STPM3X_T_STARTUP_TYP);
 
     gpio_set(dev->params.scs);
 
-    xtimer_usleep(STPM3X_T_SCS_CUST);
+    stpm3x_time_sleep(STPM3X_T_SCS_CUST);
 }
 
 void stpm3x_reset_hw(stpm3x_t *dev)
@@ -177,61 +260,384 @@ void stpm3x_reset_hw(stpm3x_t *dev)
     for (uint8_t i = 0; i < 3; i++)
     {
         gpio_clear(dev->params.syn);
-        xtimer_usleep(STPM3X_T_RPW_TYP);
+        stpm3x_time_sleep(STPM3X_T_RPW_TYP);
         gpio_set(dev->params.syn);
-        xtimer_usleep(STPM3X_T_RPW_TYP);
+        stpm3x_time_sleep(STPM3X_T_RPW_TYP);
     }
 
     // communication reset
-    xtimer_usleep(STPM3X_T_SCS_TYP);
+    stpm3x_time_sleep(STPM3X_T_SCS_TYP);
     gpio_clear(dev->params.scs);
-    xtimer_usleep(STPM3X_T_RPW_TYP);
+    stpm3x_time_sleep(STPM3X_T_RPW_TYP);
     gpio_set(dev->params.scs);
 }
 
-uint8_t stpm3x_read_reg(const stpm3x_t *dev, uint8_t reg, uint32_t *value)
+uint8_t stpm3x_read_reg(stpm3x_t *dev, uint8_t reg, uint32_t *value)
 {
-    uint8_t data_out[STPM3X_DATA_SIZE] = {reg, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
-    uint8_t data_in[STPM3X_DATA_SIZE];
+    return stpm3x_read_regs(dev, &reg, value, 1);
+}
 
-    data_out[4] = _spi_calc_crc8(data_out);
-    data_out[9] = _spi_calc_crc8(data_out+STPM3X_DATA_SIZE_STEP);
+/*
+ * Count the frames and CRC errors of a burst, step the clock down on too many errors
+ */
+static void _stpm3x_link_account(stpm3x_t *dev, unsigned frames, unsigned errors)
+{
+    stpm3x_link_t *link = &dev->link;
 
-    spi_acquire(dev->params.spi, dev->params.scs, STPM3X_SPI_MODE, dev->params.sclk);
-    spi_transfer_bytes(dev->params.spi, dev->params.scs, true, data_out, data_in, STPM3X_DATA_SIZE_STEP);
-    spi_transfer_bytes(dev->params.spi, dev->params.scs, true, data_out+STPM3X_DATA_SIZE_STEP, data_in, STPM3X_DATA_SIZE_STEP);
-    spi_release(dev->params.spi);
+    link->frames += frames;
+    link->errors += errors;
+    link->total_errors += errors;
 
-    *value = (data_in[0] | (data_in[1] << 8) | (data_in[2] << 16) | (data_in[3] << 24));
+    if ((link->errors >= STPM3X_LINK_MAX_ERRORS) && (link->clk != UINT8_MAX) && (link->clk > 0))
+    {
+        link->clk--;
+        dev->params.sclk = _spi_clks[link->clk];
+        DEBUG("%s : %u CRC errors, SPI clock stepped down to #%u\n", DEBUG_FUNC, link->errors, link->clk);
+    }
+
+    if ((link->errors >= STPM3X_LINK_MAX_ERRORS) || (link->frames >= STPM3X_LINK_WINDOW))
+    {
+        link->frames = 0;
+        link->errors = 0;
+    }
+}
+
+/*
+ * Exchange frames on the bus of the device, and trace them, called with the bus acquired
+ */
+static int _stpm3x_transfer(stpm3x_t *dev, const uint8_t *out, uint8_t *in, size_t frames)
+{
+#if IS_USED(MODULE_STPM3X_TRACE)
+    uint32_t time = stpm3x_time_now();
+#endif
+    int res = dev->transport->transfer(dev, out, in, frames);
+
+    dev->link.total_frames += frames;
+
+#if IS_USED(MODULE_STPM3X_TRACE)
+    // a replayed trace is not recorded again
+    if (dev->params.trace && (dev->transport != &stpm3x_transport_replay))
+    {
+        stpm3x_trace_record(dev->params.trace, dev->params.trace_id, time, out, in, frames,
+                            res != STPM3X_OK, dev->transport->crc);
+    }
+#endif
+
+    return res;
+}
+
+uint8_t stpm3x_read_regs(stpm3x_t *dev, const uint8_t *regs, uint32_t *values, size_t count)
+{
+    const stpm3x_transport_t *transport = dev->transport;
+    uint8_t data_out[STPM3X_BURST_FRAMES * STPM3X_FRAME_LEN];
+    uint8_t data_in[STPM3X_BURST_FRAMES * STPM3X_FRAME_LEN];
+    unsigned errors = 0;
+    uint8_t res = STPM3X_OK;
+
+    memset(data_out, 0xff, sizeof(data_out));
+
+    transport->acquire(dev);
+
+    // The answer to a frame is the register requested by the previous frame:
+    // the last frame only carries a dummy read address to clock out the last value.
+    // The pipeline goes on across the transfers of a burst.
+    for (size_t first = 0; first <= count; first += STPM3X_BURST_FRAMES)
+    {
+        size_t frames = count + 1 - first;
+        frames = (frames > STPM3X_BURST_FRAMES) ? STPM3X_BURST_FRAMES : frames;
+
+        for (size_t f = 0; f < frames; f++)
+        {
+            uint8_t *frame = &data_out[f * STPM3X_FRAME_LEN];
+
+            frame[0] = ((first + f) < count) ? regs[first + f] : 0xff;
+            frame[4] = transport->crc(frame);
+        }
+
+        bool lost = (_stpm3x_transfer(dev, data_out, data_in, frames) != STPM3X_OK);
+
+        if (lost)
+        {
+            memset(data_in, 0, sizeof(data_in));
+            res = STPM3X_ERROR;
+        }
+
+        for (size_t f = 0; f < frames; f++)
+        {
+            const uint8_t *frame = &data_in[f * STPM3X_FRAME_LEN];
+            size_t i = first + f;
+
+            if (i > 0)
+            {
+                values[i - 1] = (frame[0] | (frame[1] << 8) | (frame[2] << 16) | ((uint32_t)frame[3] << 24));
+                // the device appends the CRC of its 4 data bytes
+                errors += (lost || (transport->crc(frame) != frame[4]));
+            }
+        }
+    }
+
+    transport->release(dev);
+
+    _stpm3x_link_account(dev, count, errors);
+
+    if (res == STPM3X_OK)
+    {
+        res = (errors) ? STPM3X_ERROR_CRC : STPM3X_OK;
+    }
+
+    return res;
+}
+
+uint8_t stpm3x_link_train(stpm3x_t *dev)
+{
+    // configuration registers with a value known from the shadow
+    static const uint8_t regs[] = {
+        STPM3X_REG_US_REG1, STPM3X_REG_US_REG2, STPM3X_REG_DFE_CR1, STPM3X_REG_DFE_CR2
+    };
+    uint32_t values[ARRAY_SIZE(regs)];
+    const spi_clk_t initial = dev->params.sclk;
+    int best = -1;
+
+    if (dev->transport != &stpm3x_transport_spi)
+    {
+        return STPM3X_ERROR;
+    }
+
+    // no runtime step down while training
+    dev->link.clk = UINT8_MAX;
+
+    for (int c = ARRAY_SIZE(_spi_clks) - 1; (c >= 0) && (best < 0); c--)
+    {
+        bool clean = true;
+        dev->params.sclk = _spi_clks[c];
+
+        for (unsigned n = 0; (n < STPM3X_LINK_TRAIN_BURSTS) && clean; n++)
+        {
+            clean = (stpm3x_read_regs(dev, regs, values, ARRAY_SIZE(regs)) == STPM3X_OK);
+
+            for (unsigned i = 0; (i < ARRAY_SIZE(regs)) && clean; i++)
+            {
+                clean = (values[i] == dev->shadow[regs[i] / 2]);
+            }
+        }
+
+        best = (clean) ? c : best;
+    }
+
+    dev->link.frames = 0;
+    dev->link.errors = 0;
+    dev->link.total_errors = 0;
+    dev->link.total_frames = 0;
+
+    if (best < 0)
+    {
+        DEBUG("%s : no SPI clock without errors\n", DEBUG_FUNC);
+        dev->params.sclk = initial;
+        return STPM3X_ERROR;
+    }
+
+    best = (best > (int)STPM3X_LINK_MARGIN) ? best - (int)STPM3X_LINK_MARGIN : 0;
+    dev->link.clk = best;
+    dev->params.sclk = _spi_clks[best];
+    DEBUG("%s : SPI clock #%d selected\n", DEBUG_FUNC, best);
 
     return STPM3X_OK;
 }
 
-uint8_t stpm3x_write_reg(const stpm3x_t *dev, uint8_t reg, const uint32_t *value)
+uint8_t stpm3x_write_reg(stpm3x_t *dev, uint8_t reg, const uint32_t *value)
+{
+    return stpm3x_write_regs(dev, &reg, value, 1);
+}
+
+/**
+ * @brief Write frames waiting for a transfer
+ */
+typedef struct {
+    uint8_t out[STPM3X_BURST_FRAMES * STPM3X_FRAME_LEN];    /**< sealed frames */
+    uint8_t in[STPM3X_BURST_FRAMES * STPM3X_FRAME_LEN];     /**< answers, not used */
+    size_t frames;                                          /**< number of frames in out */
+    uint8_t res;                                            /**< STPM3X_ERROR once a transfer failed */
+} _stpm3x_burst_t;
+
+/*
+ * Send the frames waiting, called with the bus acquired
+ */
+static void _stpm3x_burst_flush(stpm3x_t *dev, _stpm3x_burst_t *burst)
+{
+    if (burst->frames)
+    {
+        // the next frames are still sent, the first error is reported
+        if (_stpm3x_transfer(dev, burst->out, burst->in, burst->frames) != STPM3X_OK)
+        {
+            burst->res = STPM3X_ERROR;
+        }
+        burst->frames = 0;
+    }
+}
+
+/*
+ * Write one 16 bits half of a register, called with the bus acquired
+ */
+static void _stpm3x_write_frame(stpm3x_t *dev, _stpm3x_burst_t *burst, uint8_t addr, uint16_t value)
+{
+    uint8_t *frame = &burst->out[burst->frames * STPM3X_FRAME_LEN];
+
+    frame[0] = 0xff;
+    frame[1] = addr;
+    frame[2] = value & 0xff;
+    frame[3] = value >> 8;
+    frame[4] = dev->transport->crc(frame);
+
+    if (++burst->frames == STPM3X_BURST_FRAMES)
+    {
+        _stpm3x_burst_flush(dev, burst);
+    }
+}
+
+uint8_t stpm3x_write_half(stpm3x_t *dev, uint8_t addr, uint16_t value)
 {
-    uint8_t data_out[STPM3X_DATA_SIZE_STEP] = {0};
-    uint8_t data_in[STPM3X_DATA_SIZE_STEP] = {0};
+    _stpm3x_burst_t burst = { .frames = 0, .res = STPM3X_OK };
+
+    dev->transport->acquire(dev);
+    _stpm3x_write_frame(dev, &burst, addr, value);
+    _stpm3x_burst_flush(dev, &burst);
+    dev->transport->release(dev);
+
+    if (addr <= (STPM3X_REG_US_REG3 + 1))
+    {
+        unsigned shift = (addr & 1) * 16;
+        uint32_t *shadow = &dev->shadow[addr / 2];
+
+        *shadow = (*shadow & ~(0xFFFFUL << shift)) | ((uint32_t)value << shift);
+    }
+
+    return burst.res;
+}
+
+uint8_t stpm3x_write_regs(stpm3x_t *dev, const uint8_t *regs, const uint32_t *values, size_t count)
+{
+    _stpm3x_burst_t burst = { .frames = 0, .res = STPM3X_OK };
+
+    dev->transport->acquire(dev);
+
+    for (size_t n = 0; n < count; n++)
+    {
+        // a 32 bits register is written as two 16 bits halves
+        _stpm3x_write_frame(dev, &burst, regs[n], values[n] & 0xffff);
+        _stpm3x_write_frame(dev, &burst, regs[n] + 1, values[n] >> 16);
+
+        if (regs[n] <= STPM3X_REG_US_REG3)
+        {
+            dev->shadow[regs[n] / 2] = (regs[n] == STPM3X_REG_DSP_CR3) ? (values[n] & ~STPM3X_CR3_COMMANDS) : values[n];
+        }
+    }
+
+    _stpm3x_burst_flush(dev, &burst);
+    dev->transport->release(dev);
+
+    return burst.res;
+}
+
+void stpm3x_power_down(stpm3x_t *dev)
+{
+    gpio_clear(dev->params.en);
+    // SCS and SYN are not left high to power the chip through its protection
+    // diodes, stpm3x_resume() brings them back up
+    gpio_clear(dev->params.scs);
+    gpio_clear(dev->params.syn);
+}
+
+uint8_t stpm3x_resume(stpm3x_t *dev, const stpm3x_lp_t *lp)
+{
+    uint8_t regs[STPM3X_SHADOW_NUMOF];
+    uint32_t values[STPM3X_SHADOW_NUMOF];
+    uint32_t check[STPM3X_SHADOW_NUMOF];
+    size_t count = 0;
+
+    // same sequence as stpm3x_lock_spi_interface(): the level of SCS on EN rising selects the interface
+    gpio_write(dev->params.scs, dev->transport->scs_level);
+    stpm3x_time_sleep(STPM3X_T_SCS_CUST);
+    gpio_set(dev->params.syn);
+    gpio_set(dev->params.en);
+    stpm3x_time_sleep(lp->startup);
+    gpio_set(dev->params.scs);
+    stpm3x_time_sleep(STPM3X_T_SCS_CUST);
+
+    // the power-on reset brought every register back to its reset value,
+    // US_REG2 is restored last as it may change the speed of the bus
+    for (uint8_t i = 0; i < STPM3X_SHADOW_NUMOF; i++)
+    {
+        uint8_t reg = 2 * i;
+
+        if ((reg != STPM3X_REG_DSP_SR1) && (reg != STPM3X_REG_DSP_SR2) && (reg != STPM3X_REG_US_REG2)
+            && (dev->shadow[i] != _reset_values[i]))
+        {
+            regs[count] = reg;
+            values[count] = dev->shadow[i];
+            count++;
+        }
+    }
 
-    data_out[0] = 0xff;
+    const uint32_t us_reg2 = dev->shadow[STPM3X_REG_US_REG2 / 2];
+    const uint32_t us_reset = _reset_values[STPM3X_REG_US_REG2 / 2];
 
-    spi_acquire(dev->params.spi, dev->params.scs, STPM3X_SPI_MODE, dev->params.sclk);
+    if (dev->transport->resync)
+    {
+        dev->transport->resync(dev, true);
+    }
+
+    mutex_lock(&dev->lock);
+    stpm3x_write_regs(dev, regs, values, count);
 
-    for (uint8_t i = 0; i < 2; i++)
+    // one half at a time: the device switches its baud rate as soon as it receives
+    // the lower one, whose answer is lost, the read back decides
+    if ((us_reg2 >> 16) != (us_reset >> 16))
     {
-        data_out[1] = reg + i; // address
-        data_out[2] = (*value >> (i * 16)) & 0xff;
-        data_out[3] = (*value >> (8 + (i * 16))) & 0xff;
-        data_out[4] = _spi_calc_crc8(data_out);
+        stpm3x_write_half(dev, STPM3X_REG_US_REG2 + 1, us_reg2 >> 16);
+    }
+    if ((us_reg2 & 0xFFFF) != (us_reset & 0xFFFF))
+    {
+        stpm3x_write_half(dev, STPM3X_REG_US_REG2, us_reg2 & 0xFFFF);
+    }
+    if (dev->transport->resync)
+    {
+        dev->transport->resync(dev, false);
+    }
+
+    regs[count] = STPM3X_REG_US_REG2;
+    values[count] = us_reg2;
+    count++;
 
-        spi_transfer_bytes(dev->params.spi, dev->params.scs, true, data_out, data_in, STPM3X_DATA_SIZE_STEP);
+    stpm3x_read_regs(dev, regs, check, count);
+    mutex_unlock(&dev->lock);
+
+    if (memcmp(values, check, count * sizeof(uint32_t)) != 0)
+    {
+        DEBUG("%s : configuration not restored\n", DEBUG_FUNC);
+        return STPM3X_ERROR;
     }
 
-    spi_release(dev->params.spi);
+    stpm3x_time_sleep(lp->settle);
 
     return STPM3X_OK;
 }
 
-#if ENABLE_DEBUG==1
+uint8_t stpm3x_lp_measure(stpm3x_t *dev, const stpm3x_lp_t *lp, stpm3x_measure_t *measure)
+{
+    uint8_t res = stpm3x_resume(dev, lp);
+
+    if (res == STPM3X_OK)
+    {
+        stpm3x_time_sleep(lp->on_time);
+        stpm3x_read_measure(dev, measure);
+    }
+
+    stpm3x_power_down(dev);
+
+    return res;
+}
+
+#if DEBUG_IRQ
 static void _stpm3x_spi_error_cb(void *arg)
 {
     struct irq_callback_args *int_args = arg;
@@ -256,84 +662,405 @@ static void _stpm3x_spi_error_cb(void *arg)
 }
 #endif
 
-static void _stpm3x_sw_latch(const stpm3x_t *dev)
+/*
+ * Latch the measurements, and give the time of the latch
+ */
+static uint32_t _stpm3x_sw_latch(stpm3x_t *dev)
 {
     uint32_t row2 = 0;
     stpm3x_read_reg(dev, STPM3X_REG_DSP_CR3, &row2);
     row2  = (row2 | 0x00600000); // S/W latch1 + S/W latch2
     stpm3x_write_reg(dev, STPM3X_REG_DSP_CR3, &row2);
+
+    // the latch took effect with the last frame of the write, a frame time at most ago
+    return stpm3x_time_now();
 }
 
-uint16_t stpm3x_read_current_rms_1(const stpm3x_t *dev)
+/*
+ * Field of the register read into each snapshot slot, in the order of STPM3X_SNAP_*
+ */
+static const uint8_t _snapshot_fields[STPM3X_SNAP_NUMOF] = {
+    [STPM3X_SNAP_PERIOD] = STPM3X_FIELD_PH1_PERIOD,
+    [STPM3X_SNAP_RMS1]   = STPM3X_FIELD_V1_RMS,
+    [STPM3X_SNAP_RMS2]   = STPM3X_FIELD_V2_RMS,
+    [STPM3X_SNAP_PHASE1] = STPM3X_FIELD_C1_PHA,
+    [STPM3X_SNAP_PHASE2] = STPM3X_FIELD_C2_PHA,
+    [STPM3X_SNAP_POWER1] = STPM3X_FIELD_PH1_ACTIVE_POWER,
+    [STPM3X_SNAP_POWER2] = STPM3X_FIELD_PH2_ACTIVE_POWER,
+};
+
+/*
+ * Snapshot slots are only read for the features compiled in
+ */
+static bool _snapshot_slot_used(unsigned slot)
 {
-    _stpm3x_sw_latch(dev);
+    const stpm3x_field_t *field = &stpm3x_fields[_snapshot_fields[slot]];
 
-    uint32_t value = 0;
-    stpm3x_read_reg(dev, STPM3X_REG_DSP_REG14, &value);
+    return (field->channel < STPM3X_CHANNELS)
+           && (IS_USED(MODULE_STPM3X_POWER) || (field->unit != STPM3X_UNIT_POWER));
+}
 
-    // SAUL works with int16_t. So through this interface, you can measure up to 32767 [mA].
-    return ((uint16_t)(((value & STPM3X_MASK_C1_RMS_DATA) >> 15) * dev->params.currentRMSLSBValue)) & 0x7FFF;
+/*
+ * Publish the last snapshot for lock-free readers, called with dev->lock held
+ */
+static void _stpm3x_publish(stpm3x_t *dev)
+{
+    uint32_t seq = dev->live.seq + 1;
+    stpm3x_live_t *live = &dev->live.buf[seq & 1];
+
+    live->rms[0] = dev->snap.reg[STPM3X_SNAP_RMS1];
+    live->rms[1] = dev->snap.reg[STPM3X_SNAP_RMS2];
+    live->power[0] = dev->snap.reg[STPM3X_SNAP_POWER1];
+    live->power[1] = dev->snap.reg[STPM3X_SNAP_POWER2];
+
+    // the new buffer must be complete before readers can select it
+    __sync_synchronize();
+    dev->live.seq = seq;
 }
 
-uint16_t stpm3x_read_voltage_rms_1(const stpm3x_t *dev)
+/*
+ * Latch and read a new snapshot, called with dev->lock held
+ */
+static uint8_t _stpm3x_snapshot(stpm3x_t *dev)
 {
-    _stpm3x_sw_latch(dev);
+    uint8_t fields[STPM3X_SNAP_NUMOF];
+    uint8_t slots[STPM3X_SNAP_NUMOF];
+    uint8_t index[STPM3X_SNAP_NUMOF];
+    uint8_t regs[STPM3X_SNAP_NUMOF];
+    uint32_t values[STPM3X_SNAP_NUMOF];
+    size_t numof = 0;
+
+    for (unsigned slot = 0; slot < STPM3X_SNAP_NUMOF; slot++)
+    {
+        if (_snapshot_slot_used(slot))
+        {
+            fields[numof] = _snapshot_fields[slot];
+            slots[numof] = slot;
+            numof++;
+        }
+    }
+
+    size_t count = stpm3x_plan_fields(fields, numof, regs, index);
 
-    uint32_t value = 0;
-    stpm3x_read_reg(dev, STPM3X_REG_DSP_REG14, &value);
+    dev->snap_begin = stpm3x_time_now();
+    dev->snap.time = _stpm3x_sw_latch(dev);
+    stpm3x_jitter_add(&dev->jitter, dev->snap.time);
 
-    return (value & STPM3X_MASK_V1_RMS_DATA) * dev->params.voltageRMSLSBValue;
+    uint8_t res = stpm3x_read_regs(dev, regs, values, count);
+
+    for (size_t i = 0; i < numof; i++)
+    {
+        dev->snap.reg[slots[i]] = values[index[i]];
+    }
+
+    for (unsigned i = 0; i < STPM3X_CHANNELS; i++)
+    {
+        if ((dev->ranging & (1 << i)) && ((dev->snap.time - dev->gain_time[i]) >= STPM3X_GAIN_SETTLE_US))
+        {
+            dev->ranging &= ~(1 << i);
+        }
+    }
+    dev->snap.ranging = dev->ranging;
+    dev->snap_res = res;
+    dev->snap_gen++;
+
+    // lock-free readers keep the last good values rather than a failed read
+    if (res == STPM3X_OK)
+    {
+        _stpm3x_publish(dev);
+    }
+
+    return res;
 }
 
-uint16_t stpm3x_read_current_rms_2(const stpm3x_t *dev)
+uint8_t stpm3x_read_snapshot(stpm3x_t *dev, stpm3x_snapshot_t *snap)
 {
-    _stpm3x_sw_latch(dev);
+    uint32_t gen = dev->snap_gen;
+    uint32_t start = stpm3x_time_now();
+
+    mutex_lock(&dev->lock);
+
+    // A snapshot completed while we were waiting for the lock may have been
+    // started before this call: it is only shared if its latch was sent after
+    // the call started, along with the result of its read.
+    if ((dev->snap_gen == gen) || ((int32_t)(dev->snap_begin - start) < 0))
+    {
+        _stpm3x_snapshot(dev);
+    }
 
-    uint32_t value = 0;
-    stpm3x_read_reg(dev, STPM3X_REG_DSP_REG15, &value);
+    *snap = dev->snap;
+    uint8_t res = dev->snap_res;
 
-    // SAUL works with int16_t. So through this interface, you can measure up to 32767 [mA].
-    return ((uint16_t)(((value & STPM3X_MASK_C2_RMS_DATA) >> 15) * dev->params.currentRMSLSBValue)) & 0x7FFF;
+    mutex_unlock(&dev->lock);
+
+    return res;
 }
 
-uint16_t stpm3x_read_voltage_rms_2(const stpm3x_t *dev)
+uint8_t stpm3x_read_latched(stpm3x_t *dev, const uint8_t *regs, uint32_t *values, size_t count)
 {
-    _stpm3x_sw_latch(dev);
+    return stpm3x_read_latched_time(dev, regs, values, count, NULL);
+}
+
+uint8_t stpm3x_read_latched_time(stpm3x_t *dev, const uint8_t *regs, uint32_t *values, size_t count,
+                                 uint32_t *time)
+{
+    mutex_lock(&dev->lock);
+
+    uint32_t latch = _stpm3x_sw_latch(dev);
+    uint8_t res = stpm3x_read_regs(dev, regs, values, count);
 
-    uint32_t value = 0;
-    stpm3x_read_reg(dev, STPM3X_REG_DSP_REG15, &value);
-    return (value & STPM3X_MASK_V2_RMS_DATA) * dev->params.voltageRMSLSBValue;
+    mutex_unlock(&dev->lock);
+
+    if (time)
+    {
+        *time = latch;
+    }
+
+    return res;
 }
 
-/*
- * Two functions taken from user manuel from ST "UM2066"- "Getting started with the STPM3x"
- */
-static uint8_t _spi_calc_crc8(uint8_t *buf)
+uint8_t stpm3x_read_snapshot_recent(stpm3x_t *dev, stpm3x_snapshot_t *snap, uint32_t max_age)
 {
-    uint8_t crc_checksum = 0x00;
+    mutex_lock(&dev->lock);
 
-    for (uint8_t i = 0; i < STPM3X_FRAME_LEN - 1; i++)
+    // a snapshot whose read failed is never recent enough
+    if ((dev->snap_gen == 0) || (dev->snap_res != STPM3X_OK)
+        || ((stpm3x_time_now() - dev->snap.time) > max_age))
     {
-        _spi_crc8_calc(buf[i], &crc_checksum);
+        _stpm3x_snapshot(dev);
     }
 
-    return crc_checksum;
+    *snap = dev->snap;
+    uint8_t res = dev->snap_res;
+
+    mutex_unlock(&dev->lock);
+
+    return res;
 }
 
-static void _spi_crc8_calc(uint8_t data, uint8_t *crc_checksum)
+uint32_t stpm3x_read_live(const stpm3x_t *dev, stpm3x_live_t *live)
 {
-    uint8_t tmp;
+    uint32_t seq;
 
-    for (uint8_t i = 0; i < 8; i++)
+    // The writer only touches the other buffer, so a reader which is never
+    // preempted for two whole publications succeeds on the first try.
+    do
     {
-        tmp = data ^ *crc_checksum;
-        *crc_checksum <<= 1;
+        seq = dev->live.seq;
+        __sync_synchronize();
+        *live = dev->live.buf[seq & 1];
+        __sync_synchronize();
+    } while (dev->live.seq != seq);
+
+    return seq;
+}
 
-        if (tmp & 0x80)
+void stpm3x_snapshot_to_measure(const stpm3x_t *dev, const stpm3x_snapshot_t *snap, stpm3x_measure_t *measure)
+{
+    const uint32_t period = snap->reg[STPM3X_SNAP_PERIOD];
+    const uint32_t voltage[2] = {
+        stpm3x_get_V1_RMS(snap->reg[STPM3X_SNAP_RMS1]), stpm3x_get_V2_RMS(snap->reg[STPM3X_SNAP_RMS2])
+    };
+    const uint32_t current[2] = {
+        stpm3x_get_C1_RMS(snap->reg[STPM3X_SNAP_RMS1]), stpm3x_get_C2_RMS(snap->reg[STPM3X_SNAP_RMS2])
+    };
+#if IS_USED(MODULE_STPM3X_POWER)
+    const int32_t power[2] = {
+        stpm3x_get_PH1_ACTIVE_POWER(snap->reg[STPM3X_SNAP_POWER1]),
+        stpm3x_get_PH2_ACTIVE_POWER(snap->reg[STPM3X_SNAP_POWER2])
+    };
+#endif
+
+    memset(measure, 0, sizeof(*measure));
+
+    for (unsigned i = 0; i < STPM3X_CHANNELS; i++)
+    {
+        measure->voltage[i] = ((uint64_t)voltage[i] * dev->lsb.voltage) / 1000;
+        measure->current[i] = ((uint64_t)current[i] * dev->lsb.current[i]) / 1000;
+#if IS_USED(MODULE_STPM3X_POWER)
+        measure->power[i] = ((int64_t)power[i] * dev->lsb.power[i]) / 1000000;
+#endif
+    }
+
+    measure->period[0] = stpm3x_get_PH1_PERIOD(period) * STPM3X_PERIOD_LSB_US;
+    measure->period[1] = stpm3x_get_PH2_PERIOD(period) * STPM3X_PERIOD_LSB_US;
+    measure->time = snap->time;
+    measure->ranging = snap->ranging;
+}
+
+uint8_t stpm3x_read_measure(stpm3x_t *dev, stpm3x_measure_t *measure)
+{
+    stpm3x_snapshot_t snap;
+    uint8_t res = stpm3x_read_snapshot(dev, &snap);
+
+    stpm3x_snapshot_to_measure(dev, &snap, measure);
+
+    return res;
+}
+
+void stpm3x_measure_to_fields(const stpm3x_measure_t *measure, int32_t *fields)
+{
+    for (unsigned i = 0; i < 2; i++)
+    {
+        fields[(4 * i) + 0] = measure->voltage[i];
+        fields[(4 * i) + 1] = measure->current[i];
+        fields[(4 * i) + 2] = measure->power[i];
+        fields[(4 * i) + 3] = measure->period[i];
+    }
+}
+
+void stpm3x_snapshot_to_line(const stpm3x_snapshot_t *snap, stpm3x_line_t *line)
+{
+    const uint32_t period = snap->reg[STPM3X_SNAP_PERIOD];
+    const uint32_t raw_period[2] = { stpm3x_get_PH1_PERIOD(period), stpm3x_get_PH2_PERIOD(period) };
+    const uint32_t raw_phase[2] = {
+        stpm3x_get_C1_PHA(snap->reg[STPM3X_SNAP_PHASE1]), stpm3x_get_C2_PHA(snap->reg[STPM3X_SNAP_PHASE2])
+    };
+
+    for (unsigned i = 0; i < 2; i++)
+    {
+        if (raw_period[i] == 0)
+        {
+            line->frequency[i] = 0;
+            line->angle[i] = 0;
+            line->pf[i] = 0;
+            continue;
+        }
+
+        line->frequency[i] = 1000000000UL / (raw_period[i] * STPM3X_PERIOD_LSB_US);
+
+        // phase and period share their LSB: the ratio is a fraction of turn
+        uint32_t turn = ((uint64_t)raw_phase[i] << 32) / raw_period[i];
+        int32_t angle = ((int64_t)raw_phase[i] * 360000) / raw_period[i];
+        line->angle[i] = (angle > 180000) ? angle - 360000 : angle;
+        line->pf[i] = ((int32_t)stpm3x_cos_q15(turn) * 1000 + (1 << 14)) >> 15;
+    }
+}
+
+uint8_t stpm3x_read_line(stpm3x_t *dev, stpm3x_line_t *line)
+{
+    stpm3x_snapshot_t snap;
+    uint8_t res = stpm3x_read_snapshot(dev, &snap);
+
+    stpm3x_snapshot_to_line(&snap, line);
+
+    return res;
+}
+
+#if IS_USED(MODULE_STPM3X_WAVE)
+uint8_t stpm3x_wave_capture(stpm3x_t *dev, uint8_t channels, int32_t *samples, uint32_t *times, size_t count,
+                            uint32_t sample_us)
+{
+    // instantaneous data registers, in the order of STPM3X_WAVE_*
+    static const uint8_t data_regs[] = {
+        STPM3X_REG_DSP_REG2, STPM3X_REG_DSP_REG3, STPM3X_REG_DSP_REG4, STPM3X_REG_DSP_REG5
+    };
+    uint8_t regs[ARRAY_SIZE(data_regs)];
+    uint32_t values[ARRAY_SIZE(data_regs)];
+    size_t num = 0;
+    uint8_t res = STPM3X_OK;
+
+    for (unsigned i = 0; i < ARRAY_SIZE(data_regs); i++)
+    {
+        if (channels & (1 << i))
+        {
+            regs[num++] = data_regs[i];
+        }
+    }
+
+    uint32_t last = stpm3x_time_now();
+
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t time;
+        uint8_t ret = stpm3x_read_latched_time(dev, regs, values, num, &time);
+
+        // the capture goes on after an error, the first one is reported
+        res = (res == STPM3X_OK) ? ret : res;
+
+        if (times)
         {
-            *crc_checksum ^= STPM3X_CRC_8;
+            times[i] = time;
         }
 
-        data <<= 1;
+        for (size_t ch = 0; ch < num; ch++)
+        {
+            // all data registers have the 24 bits signed layout of V1_DATA
+            samples[(ch * count) + i] = stpm3x_get_V1_DATA(values[ch]);
+        }
+
+        stpm3x_time_periodic_wakeup(&last, sample_us);
     }
+
+    return res;
+}
+#endif
+
+/*
+ * Convert a value in micro-units to milli-units for the 16 bits getters
+ */
+static uint16_t _stpm3x_to_milli(int32_t value)
+{
+    value /= 1000;
+
+    return (value > UINT16_MAX) ? UINT16_MAX : (uint16_t)value;
 }
+
+uint16_t stpm3x_read_current_rms_1(stpm3x_t *dev)
+{
+    stpm3x_measure_t measure;
+    stpm3x_read_measure(dev, &measure);
+
+    return _stpm3x_to_milli(measure.current[0]);
+}
+
+uint16_t stpm3x_read_voltage_rms_1(stpm3x_t *dev)
+{
+    stpm3x_measure_t measure;
+    stpm3x_read_measure(dev, &measure);
+
+    return _stpm3x_to_milli(measure.voltage[0]);
+}
+
+#if IS_USED(MODULE_STPM3X_CH2)
+uint16_t stpm3x_read_current_rms_2(stpm3x_t *dev)
+{
+    stpm3x_measure_t measure;
+    stpm3x_read_measure(dev, &measure);
+
+    return _stpm3x_to_milli(measure.current[1]);
+}
+
+uint16_t stpm3x_read_voltage_rms_2(stpm3x_t *dev)
+{
+    stpm3x_measure_t measure;
+    stpm3x_read_measure(dev, &measure);
+
+    return _stpm3x_to_milli(measure.voltage[1]);
+}
+#endif
+
+#ifdef MODULE_MTD
+int stpm3x_mtd_write(mtd_dev_t *mtd, uint32_t addr, const void *data, uint32_t len)
+{
+    const uint8_t *src = data;
+
+    while (len)
+    {
+        uint32_t num = mtd->page_size - (addr % mtd->page_size);
+        num = (len < num) ? len : num;
+
+        if (mtd_write(mtd, src, addr, num) < 0)
+        {
+            DEBUG("%s : could not write at 0x%lx\n", DEBUG_FUNC, (unsigned long)addr);
+            return STPM3X_ERROR;
+        }
+
+        src += num;
+        addr += num;
+        len -= num;
+    }
+
+    return STPM3X_OK;
+}
+#endif
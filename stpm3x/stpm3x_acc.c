@@ -0,0 +1,246 @@
+/*
+ * Copyright (C) 2020 eeproperty Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     drivers_stpm3x
+ * @{
+ *
+ * @file
+ * @brief       Chip-side accumulation of energy and charge
+ *              The host only reads the accumulators of the STPM3x once per interval,
+ *              ampere-hour accounting extends the charge accumulators to 64 bits.
+ *
+ * @author      Joël Carron <jo.carron@cartondu.ch>
+ *
+ * @}
+ */
+
+#include <stdint.h>
+
+#include "assert.h"
+#include "kernel_defines.h"
+#include "mutex.h"
+
+#include "stpm3x.h"
+#include "stpm3x_internals.h"
+#include "stpm3x_time.h"
+
+/**
+ * @brief Accumulators read at each interval, in the order of stpm3x_acc_t::raw
+ */
+static const uint8_t _acc_regs[4] = {
+    STPM3X_REG_PH1_REG1, STPM3X_REG_PH2_REG1, STPM3X_REG_PH1_REG12, STPM3X_REG_PH2_REG12
+};
+
+/**
+ * @brief Ampere-hour accumulators read by stpm3x_ah_read(), in the order of stpm3x_ah_t::raw
+ */
+static const uint8_t _ah_regs[2] = {
+    STPM3X_REG_PH1_REG12, STPM3X_REG_PH2_REG12
+};
+
+/**
+ * @brief Picoampere-hours in one nanoampere-hour
+ */
+#define PAH_PER_NAH             (1000)
+
+/**
+ * @brief Nanoampere-hours in one milliampere-hour
+ */
+#define NAH_PER_MAH             (1000000LL)
+
+/*
+ * Enable the cumulative accumulation and set the AH_UP/AH_DOWN thresholds of
+ * DSP_CR9 to DSP_CR12, given in this order
+ */
+static void _enable_cum(stpm3x_t *dev, const uint16_t *thresholds)
+{
+    static const uint8_t regs[4] = {
+        STPM3X_REG_DSP_CR9, STPM3X_REG_DSP_CR10, STPM3X_REG_DSP_CR11, STPM3X_REG_DSP_CR12
+    };
+    uint32_t rows[4];
+    uint32_t row = 0;
+
+    // the read-modify-writes must not interleave with the latches of DSP_CR3
+    mutex_lock(&dev->lock);
+
+    stpm3x_read_reg(dev, STPM3X_REG_DSP_CR3, &row);
+    row |= STPM3X_MASK_EN_CUM;
+    stpm3x_write_reg(dev, STPM3X_REG_DSP_CR3, &row);
+
+    // the offsets in the upper bits of the registers are kept
+    for (unsigned i = 0; i < ARRAY_SIZE(regs); i++)
+    {
+        // same field as AH_DOWN1, AH_UP2 and AH_DOWN2
+        rows[i] = (dev->shadow[regs[i] / 2] & ~STPM3X_MASK_AH_UP1) | (thresholds[i] & STPM3X_MASK_AH_UP1);
+    }
+    stpm3x_write_regs(dev, regs, rows, ARRAY_SIZE(regs));
+
+    mutex_unlock(&dev->lock);
+}
+
+/*
+ * 64 bits time of a latch taken less than a clock wrap ago
+ */
+static uint64_t _latch_time64(uint32_t latch)
+{
+    uint64_t now = stpm3x_time_now64();
+
+    return now - (uint32_t)((uint32_t)now - latch);
+}
+
+uint8_t stpm3x_acc_start(stpm3x_acc_t *acc, stpm3x_t *dev, uint32_t interval)
+{
+    assert(acc && dev);
+
+    // AH_UP and AH_DOWN thresholds at 0: the charge is accumulated at any current
+    static const uint16_t thresholds[4] = { 0, 0, 0, 0 };
+
+    acc->dev = dev;
+    acc->interval = interval;
+
+    _enable_cum(dev, thresholds);
+
+    for (unsigned i = 0; i < 2; i++)
+    {
+        acc->energy[i] = 0;
+        acc->charge[i] = 0;
+    }
+
+    uint32_t latch;
+    uint8_t res = stpm3x_read_latched_time(dev, _acc_regs, acc->raw, ARRAY_SIZE(_acc_regs), &latch);
+
+    acc->time = _latch_time64(latch);
+
+    return res;
+}
+
+uint8_t stpm3x_acc_read(stpm3x_acc_t *acc, stpm3x_acc_result_t *res)
+{
+    assert(acc && res);
+
+    uint32_t raw[ARRAY_SIZE(_acc_regs)];
+    uint32_t latch;
+    uint8_t ret = stpm3x_read_latched_time(acc->dev, _acc_regs, raw, ARRAY_SIZE(_acc_regs), &latch);
+
+    // the totals and the reference of the next interval are kept, the next read covers this one too
+    if (ret != STPM3X_OK)
+    {
+        return ret;
+    }
+
+    uint64_t now = _latch_time64(latch);
+
+    res->interval = (now - acc->time) / 1000;
+
+    for (unsigned i = 0; i < 2; i++)
+    {
+        // accumulators wrap around: their difference is right as long as it fits in 31 bits
+        int32_t d_energy = raw[i] - acc->raw[i];
+        int32_t d_charge = raw[2 + i] - acc->raw[2 + i];
+        // channel 2 reads as 0 without stpm3x_ch2
+        uint32_t lsb_energy = (i < STPM3X_CHANNELS) ? acc->dev->lsb.energy[i] : 0;
+        uint32_t lsb_charge = (i < STPM3X_CHANNELS) ? acc->dev->lsb.charge[i] : 0;
+
+        res->energy[i] = ((int64_t)d_energy * lsb_energy) / 1000000;
+        res->charge[i] = ((int64_t)d_charge * lsb_charge) / 1000000;
+
+        // [uWh] * 3600 / [ms] = [mW], [uAh] * 3600000 / [ms] = [uA]
+        res->power[i] = (res->interval) ? (res->energy[i] * 3600) / res->interval : 0;
+        res->current[i] = (res->interval) ? (res->charge[i] * 3600000) / res->interval : 0;
+
+        acc->energy[i] += res->energy[i];
+        acc->charge[i] += res->charge[i];
+    }
+
+    for (unsigned i = 0; i < ARRAY_SIZE(_acc_regs); i++)
+    {
+        acc->raw[i] = raw[i];
+    }
+    acc->time = now;
+
+    return ret;
+}
+
+uint8_t stpm3x_acc_next(stpm3x_acc_t *acc, stpm3x_acc_result_t *res)
+{
+    assert(acc && res);
+
+    uint64_t end = acc->time + ((uint64_t)acc->interval * 1000);
+    uint64_t now = stpm3x_time_now64();
+
+    if (end > now)
+    {
+        stpm3x_time_sleep64(end - now);
+    }
+
+    return stpm3x_acc_read(acc, res);
+}
+
+uint8_t stpm3x_ah_start(stpm3x_ah_t *ah, stpm3x_t *dev, const stpm3x_ah_config_t *config)
+{
+    assert(ah && dev && config);
+
+    const uint16_t thresholds[4] = { config->up[0], config->down[0], config->up[1], config->down[1] };
+
+    ah->dev = dev;
+
+    _enable_cum(dev, thresholds);
+
+    for (unsigned i = 0; i < 2; i++)
+    {
+        ah->count[i] = 0;
+        ah->charge[i] = 0;
+        ah->rem[i] = 0;
+    }
+
+    return stpm3x_read_latched_time(dev, _ah_regs, ah->raw, ARRAY_SIZE(_ah_regs), &ah->time);
+}
+
+uint8_t stpm3x_ah_read(stpm3x_ah_t *ah, int32_t *mah)
+{
+    assert(ah);
+
+    uint32_t raw[ARRAY_SIZE(_ah_regs)];
+    uint32_t time;
+    uint8_t res = stpm3x_read_latched_time(ah->dev, _ah_regs, raw, ARRAY_SIZE(_ah_regs), &time);
+
+    // the state is kept, the next read counts the charge of this one too
+    if (res != STPM3X_OK)
+    {
+        return res;
+    }
+
+    ah->time = time;
+
+    for (unsigned i = 0; i < STPM3X_CHANNELS; i++)
+    {
+        // the accumulators wrap around: their difference is right as long as it fits in 31 bits
+        int32_t delta = raw[i] - ah->raw[i];
+
+        ah->raw[i] = raw[i];
+        ah->count[i] += delta;
+        // converted at each read with the LSB in use, which follows the gain of the channel;
+        // kept in nAh so that it does not wrap, the pAh below are carried to the next read
+        int64_t pah = (int64_t)delta * ah->dev->lsb.charge[i] + ah->rem[i];
+        ah->charge[i] += pah / PAH_PER_NAH;
+        ah->rem[i] = pah % PAH_PER_NAH;
+
+        if (mah)
+        {
+            mah[i] = ah->charge[i] / NAH_PER_MAH;
+        }
+    }
+
+    if (mah && (STPM3X_CHANNELS < 2))
+    {
+        mah[1] = 0;
+    }
+
+    return res;
+}
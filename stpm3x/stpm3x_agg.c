@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2020 eeproperty Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     drivers_stpm3x
+ * @{
+ *
+ * @file
+ * @brief       Windowed aggregation of the STPM3x measurements
+ *              Running min/max/sum/sum of squares are kept per quantity and emitted when a window completes.
+ *
+ * @author      Joël Carron <jo.carron@cartondu.ch>
+ *
+ * @}
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "assert.h"
+
+#include "stpm3x.h"
+#include "stpm3x_math.h"
+
+/*
+ * Clear the running sums of the window
+ */
+static void _reset(stpm3x_agg_t *agg)
+{
+    agg->count = 0;
+
+    for (unsigned i = 0; i < STPM3X_AGG_NUMOF; i++)
+    {
+        agg->stat[i].min = INT32_MAX;
+        agg->stat[i].max = INT32_MIN;
+        agg->stat[i].sum = 0;
+        agg->stat[i].sum_sq = 0;
+        agg->stat[i].sum_sq_hi = 0;
+    }
+}
+
+/*
+ * Mean of the squares summed on 96 bits, divided 32 bits at a time.
+ * The mean of int32_t squares fits in 64 bits: the upper word of the quotient is 0.
+ */
+static uint64_t _mean_sq(const stpm3x_agg_stat_t *stat, uint32_t count)
+{
+    uint64_t mid = ((uint64_t)(stat->sum_sq_hi % count) << 32) | (stat->sum_sq >> 32);
+    uint64_t low = ((mid % count) << 32) | (stat->sum_sq & 0xFFFFFFFF);
+
+    return ((mid / count) << 32) + (low / count);
+}
+
+static void _emit(stpm3x_agg_t *agg)
+{
+    stpm3x_agg_result_t res = {
+        .start = agg->start,
+        .end = agg->last,
+        .count = agg->count
+    };
+
+    for (unsigned i = 0; i < STPM3X_AGG_NUMOF; i++)
+    {
+        const stpm3x_agg_stat_t *stat = &agg->stat[i];
+
+        res.value[i].min = stat->min;
+        res.value[i].max = stat->max;
+        res.value[i].mean = stat->sum / (int64_t)agg->count;
+        res.value[i].rms = stpm3x_isqrt(_mean_sq(stat, agg->count));
+    }
+
+    if (agg->cb)
+    {
+        agg->cb(&res, agg->arg);
+    }
+}
+
+void stpm3x_agg_init(stpm3x_agg_t *agg, stpm3x_agg_window_t window, uint32_t length,
+                     stpm3x_agg_cb_t cb, void *arg)
+{
+    assert(agg && length);
+
+    agg->window = window;
+    agg->length = length;
+    agg->cb = cb;
+    agg->arg = arg;
+    agg->started = false;
+    agg->cycles = 0;
+
+    _reset(agg);
+}
+
+void stpm3x_agg_update(stpm3x_agg_t *agg, const stpm3x_measure_t *measure, uint32_t now)
+{
+    const int32_t values[STPM3X_AGG_NUMOF] = {
+        [STPM3X_AGG_VOLTAGE1] = measure->voltage[0],
+        [STPM3X_AGG_CURRENT1] = measure->current[0],
+        [STPM3X_AGG_POWER1] = measure->power[0],
+        [STPM3X_AGG_VOLTAGE2] = measure->voltage[1],
+        [STPM3X_AGG_CURRENT2] = measure->current[1],
+        [STPM3X_AGG_POWER2] = measure->power[1],
+    };
+
+    if (!agg->started)
+    {
+        agg->started = true;
+        agg->start = now;
+    }
+    else
+    {
+        if (measure->period[0])
+        {
+            // line cycles elapsed since the previous sample, also across windows
+            agg->cycles += ((uint64_t)(now - agg->last) << 8) / measure->period[0];
+        }
+
+        // a time window is complete with the first sample past its end, which
+        // belongs to the next window: windows without any sample are skipped
+        if ((agg->window == STPM3X_AGG_WINDOW_TIME) && ((now - agg->start) >= agg->length))
+        {
+            _emit(agg);
+            _reset(agg);
+            agg->start += ((now - agg->start) / agg->length) * agg->length;
+        }
+    }
+
+    agg->last = now;
+    agg->count++;
+
+    for (unsigned i = 0; i < STPM3X_AGG_NUMOF; i++)
+    {
+        stpm3x_agg_stat_t *stat = &agg->stat[i];
+        int32_t value = values[i];
+
+        stat->min = (value < stat->min) ? value : stat->min;
+        stat->max = (value > stat->max) ? value : stat->max;
+        stat->sum += value;
+
+        // the squares are summed on 96 bits so that 2^32 samples of any int32_t value fit
+        uint64_t square = (uint64_t)((int64_t)value * value);
+        stat->sum_sq += square;
+        stat->sum_sq_hi += (stat->sum_sq < square);
+    }
+
+    bool complete;
+
+    switch (agg->window)
+    {
+        case STPM3X_AGG_WINDOW_CYCLES:
+            complete = (agg->cycles >= ((uint64_t)agg->length << 8));
+            break;
+        case STPM3X_AGG_WINDOW_SAMPLES:
+            complete = (agg->count >= agg->length);
+            break;
+        default:
+            complete = false;
+    }
+
+    if (complete)
+    {
+        _emit(agg);
+        _reset(agg);
+        // the next window starts where this one ends, with the cycles in excess
+        agg->start = now;
+        agg->cycles %= ((uint64_t)agg->length << 8);
+    }
+}
+
+uint8_t stpm3x_agg_read(stpm3x_t *dev, stpm3x_agg_t *aggs, size_t numof)
+{
+    stpm3x_measure_t measure;
+    uint8_t res = stpm3x_read_measure(dev, &measure);
+
+    // a failed read would spoil the min, max and RMS of the whole window
+    if (res != STPM3X_OK)
+    {
+        return res;
+    }
+
+    for (size_t i = 0; i < numof; i++)
+    {
+        stpm3x_agg_update(&aggs[i], &measure, measure.time);
+    }
+
+    return res;
+}
@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2020 eeproperty Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     drivers_stpm3x
+ * @{
+ *
+ * @file
+ * @brief       Asynchronous request queue of the STPM3x driver
+ *              One worker thread per SPI bus serves the requests submitted by the application threads.
+ *
+ * @author      Joël Carron <jo.carron@cartondu.ch>
+ *
+ * @}
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "assert.h"
+#include "msg.h"
+#include "mutex.h"
+#include "thread.h"
+
+#include "stpm3x.h"
+
+#define ENABLE_DEBUG    (DEBUG_MODE)
+#include "debug.h"
+
+static void _complete(stpm3x_req_t *req, int res)
+{
+    req->res = res;
+
+    if (req->cb)
+    {
+        req->cb(req, req->arg);
+    }
+    else
+    {
+        msg_t msg = {
+            .type = STPM3X_ASYNC_MSG_DONE,
+            .content.ptr = req
+        };
+
+        // blocks until the owner receives it if its queue is full or missing
+        if (msg_send(&msg, req->owner) != 1)
+        {
+            DEBUG("%s : owner %d of the request is gone\n", DEBUG_FUNC, (int)req->owner);
+        }
+    }
+}
+
+/*
+ * Serve a detached list of requests.
+ * Merged requests are unlinked from the list as soon as they are completed.
+ */
+static void _serve(stpm3x_req_t *list)
+{
+    while (list)
+    {
+        stpm3x_req_t *req = list;
+        list = req->next;
+
+        if (req->type == STPM3X_REQ_SNAPSHOT)
+        {
+            int res = stpm3x_read_snapshot(req->dev, req->snap);
+
+            // the next snapshots of the same device are served by this one, up
+            // to a write to the device: the later ones must see its effect
+            for (stpm3x_req_t **it = &list; *it;)
+            {
+                stpm3x_req_t *other = *it;
+
+                if (other->dev != req->dev)
+                {
+                    it = &other->next;
+                }
+                else if (other->type == STPM3X_REQ_WRITE)
+                {
+                    break;
+                }
+                else if (other->type == STPM3X_REQ_SNAPSHOT)
+                {
+                    *it = other->next;
+                    *other->snap = *req->snap;
+                    _complete(other, res);
+                }
+                else
+                {
+                    it = &other->next;
+                }
+            }
+
+            _complete(req, res);
+        }
+        else
+        {
+            // only the last of consecutive writes to the same register reaches the bus
+            stpm3x_req_t *merged = NULL;
+
+            while (list && (list->type == STPM3X_REQ_WRITE) && (list->dev == req->dev) && (list->reg == req->reg))
+            {
+                stpm3x_req_t *last = list;
+                list = last->next;
+                req->next = merged;
+                merged = req;
+                req = last;
+            }
+
+            int res = stpm3x_write_reg(req->dev, req->reg, &req->value);
+
+            while (merged)
+            {
+                stpm3x_req_t *done = merged;
+                merged = done->next;
+                _complete(done, res);
+            }
+
+            _complete(req, res);
+        }
+    }
+}
+
+static void *_worker(void *arg)
+{
+    stpm3x_async_t *bus = arg;
+
+    while (1)
+    {
+        // unlocked by each submit, a submit done while serving leaves it unlocked
+        mutex_lock(&bus->wake);
+
+        mutex_lock(&bus->lock);
+        stpm3x_req_t *list = bus->head;
+        bus->head = NULL;
+        bus->tail = NULL;
+        mutex_unlock(&bus->lock);
+
+        _serve(list);
+    }
+
+    return NULL;
+}
+
+int stpm3x_async_init(stpm3x_async_t *bus, char *stack, int stacksize, uint8_t prio, const char *name)
+{
+    assert(bus && stack);
+
+    mutex_init(&bus->lock);
+    mutex_init(&bus->wake);
+    mutex_lock(&bus->wake);
+    bus->head = NULL;
+    bus->tail = NULL;
+
+    bus->pid = thread_create(stack, stacksize, prio, THREAD_CREATE_STACKTEST, _worker, bus, name);
+
+    if (bus->pid <= KERNEL_PID_UNDEF)
+    {
+        DEBUG("%s : could not create the worker thread\n", DEBUG_FUNC);
+        return STPM3X_ERROR;
+    }
+
+    return STPM3X_OK;
+}
+
+int stpm3x_async_submit(stpm3x_async_t *bus, stpm3x_req_t *req)
+{
+    assert(bus && req && req->dev);
+    assert((req->type != STPM3X_REQ_SNAPSHOT) || req->snap);
+
+    req->next = NULL;
+    req->owner = thread_getpid();
+
+    mutex_lock(&bus->lock);
+    if (bus->head == NULL)
+    {
+        bus->head = req;
+    }
+    else
+    {
+        bus->tail->next = req;
+    }
+    bus->tail = req;
+    mutex_unlock(&bus->lock);
+
+    // the worker drains the whole queue on each wake up: one pending wake up is enough
+    mutex_unlock(&bus->wake);
+
+    return STPM3X_OK;
+}
@@ -0,0 +1,284 @@
+/*
+ * Copyright (C) 2020 eeproperty Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     drivers_stpm3x
+ * @{
+ *
+ * @file
+ * @brief       Calibration records of the STPM3x driver
+ *              Stored in MTD, applied in one burst and read back.
+ *
+ * @author      Joël Carron <jo.carron@cartondu.ch>
+ *
+ * @}
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "assert.h"
+#include "checksum/crc16_ccitt.h"
+#include "mutex.h"
+
+#include "stpm3x.h"
+#include "stpm3x_internals.h"
+#include "stpm3x_time.h"
+
+#define ENABLE_DEBUG    (DEBUG_MODE)
+#include "debug.h"
+
+/**
+ * @brief 0.875, the scale of a calibrator at 0, in [1/16384]
+ */
+#define CALIB_BASE              (14336L)
+
+/**
+ * @brief Calibrator field of DSP_CR5 to DSP_CR8
+ */
+#define CALIB_CH_MASK           (STPM3X_MASK_CHV1)
+
+/**
+ * @brief Record index of the gain calibrators, in the order of stpm3x_calib_ref_t
+ */
+enum {
+    _CHV1 = (STPM3X_REG_DSP_CR5 - STPM3X_REG_DSP_CR4) / 2,
+    _CHC1 = (STPM3X_REG_DSP_CR6 - STPM3X_REG_DSP_CR4) / 2,
+    _CHV2 = (STPM3X_REG_DSP_CR7 - STPM3X_REG_DSP_CR4) / 2,
+    _CHC2 = (STPM3X_REG_DSP_CR8 - STPM3X_REG_DSP_CR4) / 2,
+};
+
+/*
+ * Calibration fields of DSP_CR4 to DSP_CR12, the other fields are not touched
+ */
+static const uint32_t _masks[STPM3X_CALIB_NUMOF] = {
+    STPM3X_MASK_PHC1 | STPM3X_MASK_PHV1 | STPM3X_MASK_PHC2 | STPM3X_MASK_PHV2,
+    STPM3X_MASK_CHV1,
+    STPM3X_MASK_CHC1,
+    STPM3X_MASK_CHV2,
+    STPM3X_MASK_CHC2,
+    STPM3X_MASK_OFA1 | STPM3X_MASK_OFAF1,
+    STPM3X_MASK_OFR1 | STPM3X_MASK_OFS1,
+    STPM3X_MASK_OFA2 | STPM3X_MASK_OFAF2,
+    STPM3X_MASK_OFR2 | STPM3X_MASK_OFS2,
+};
+
+static uint8_t _reg(unsigned index)
+{
+    return STPM3X_REG_DSP_CR4 + (2 * index);
+}
+
+void stpm3x_calib_seal(stpm3x_calib_t *calib)
+{
+    assert(calib);
+
+    calib->magic = STPM3X_CALIB_MAGIC;
+    calib->version = STPM3X_CALIB_VERSION;
+    calib->size = sizeof(stpm3x_calib_t);
+    calib->reserved = 0;
+    calib->crc = crc16_ccitt_calc((const uint8_t *)calib, offsetof(stpm3x_calib_t, crc));
+}
+
+bool stpm3x_calib_valid(const stpm3x_calib_t *calib)
+{
+    assert(calib);
+
+    return (calib->magic == STPM3X_CALIB_MAGIC) && (calib->version == STPM3X_CALIB_VERSION) &&
+           (calib->size == sizeof(stpm3x_calib_t)) &&
+           (calib->crc == crc16_ccitt_calc((const uint8_t *)calib, offsetof(stpm3x_calib_t, crc)));
+}
+
+void stpm3x_calib_default(stpm3x_calib_t *calib)
+{
+    assert(calib);
+
+    // no phase compensation, unity gains and no offsets
+    memset(calib, 0, sizeof(*calib));
+    calib->reg[_CHV1] = STPM3X_CALIB_UNITY;
+    calib->reg[_CHC1] = STPM3X_CALIB_UNITY;
+    calib->reg[_CHV2] = STPM3X_CALIB_UNITY;
+    calib->reg[_CHC2] = STPM3X_CALIB_UNITY;
+
+    stpm3x_calib_seal(calib);
+}
+
+void stpm3x_calib_get(const stpm3x_t *dev, stpm3x_calib_t *calib)
+{
+    assert(dev && calib);
+
+    memset(calib, 0, sizeof(*calib));
+
+    for (unsigned i = 0; i < STPM3X_CALIB_NUMOF; i++)
+    {
+        calib->reg[i] = dev->shadow[_reg(i) / 2] & _masks[i];
+    }
+
+    stpm3x_calib_seal(calib);
+}
+
+int stpm3x_calib_apply(stpm3x_t *dev, const stpm3x_calib_t *calib)
+{
+    assert(dev && calib);
+
+    uint8_t regs[STPM3X_CALIB_NUMOF];
+    uint32_t values[STPM3X_CALIB_NUMOF];
+    uint32_t check[STPM3X_CALIB_NUMOF];
+
+    if (!stpm3x_calib_valid(calib))
+    {
+        DEBUG("%s : not a calibration record of version %u\n", DEBUG_FUNC, STPM3X_CALIB_VERSION);
+        return STPM3X_ERROR;
+    }
+
+    mutex_lock(&dev->lock);
+
+    for (unsigned i = 0; i < STPM3X_CALIB_NUMOF; i++)
+    {
+        regs[i] = _reg(i);
+        values[i] = (dev->shadow[regs[i] / 2] & ~_masks[i]) | (calib->reg[i] & _masks[i]);
+    }
+
+    // all the registers in back to back bursts, then one burst to read them back
+    int res = stpm3x_write_regs(dev, regs, values, STPM3X_CALIB_NUMOF);
+
+    if (res == STPM3X_OK)
+    {
+        res = (stpm3x_read_regs(dev, regs, check, STPM3X_CALIB_NUMOF) == STPM3X_OK) ? STPM3X_OK : STPM3X_ERROR;
+    }
+
+    mutex_unlock(&dev->lock);
+
+    for (unsigned i = 0; (i < STPM3X_CALIB_NUMOF) && (res == STPM3X_OK); i++)
+    {
+        if ((check[i] ^ values[i]) & _masks[i])
+        {
+            DEBUG("%s : register 0x%02x reads 0x%08lx\n", DEBUG_FUNC, regs[i], (unsigned long)check[i]);
+            res = STPM3X_ERROR;
+        }
+    }
+
+    return res;
+}
+
+/*
+ * Rescale the calibrator of a register by ref / measured
+ */
+static int _rescale(uint32_t *row, uint32_t ref, int64_t measured)
+{
+    if (measured <= 0)
+    {
+        return STPM3X_ERROR;
+    }
+
+    // the scale of the channel is (CALIB_BASE + calibrator) / 16384
+    int64_t scale = CALIB_BASE + (*row & CALIB_CH_MASK);
+    int64_t ch = (((scale * ref) + (measured / 2)) / measured) - CALIB_BASE;
+
+    if ((ch < 0) || (ch > CALIB_CH_MASK))
+    {
+        DEBUG("%s : %lu measured for %lu, out of the calibration range\n", DEBUG_FUNC,
+              (unsigned long)measured, (unsigned long)ref);
+        return STPM3X_ERROR;
+    }
+
+    *row = (*row & ~CALIB_CH_MASK) | (uint32_t)ch;
+
+    return STPM3X_OK;
+}
+
+int stpm3x_calib_run(stpm3x_t *dev, const stpm3x_calib_ref_t *ref, stpm3x_calib_t *calib)
+{
+    assert(dev && ref && calib);
+
+    int64_t voltage[2] = { 0, 0 };
+    int64_t current[2] = { 0, 0 };
+    uint32_t last = stpm3x_time_now();
+
+    for (unsigned n = 0; n < STPM3X_CALIB_SAMPLES; n++)
+    {
+        stpm3x_measure_t measure;
+
+        stpm3x_time_periodic_wakeup(&last, STPM3X_CALIB_INTERVAL_US);
+
+        // a gain switch during the calibration would bias the current
+        if ((stpm3x_read_measure(dev, &measure) != STPM3X_OK) || measure.ranging)
+        {
+            return STPM3X_ERROR;
+        }
+
+        for (unsigned i = 0; i < 2; i++)
+        {
+            voltage[i] += measure.voltage[i];
+            current[i] += measure.current[i];
+        }
+    }
+
+    stpm3x_calib_get(dev, calib);
+
+    static const uint8_t chv[2] = { _CHV1, _CHV2 };
+    static const uint8_t chc[2] = { _CHC1, _CHC2 };
+
+    for (unsigned i = 0; i < STPM3X_CHANNELS; i++)
+    {
+        if ((ref->voltage[i] &&
+             (_rescale(&calib->reg[chv[i]], ref->voltage[i], voltage[i] / STPM3X_CALIB_SAMPLES) != STPM3X_OK)) ||
+            (ref->current[i] &&
+             (_rescale(&calib->reg[chc[i]], ref->current[i], current[i] / STPM3X_CALIB_SAMPLES) != STPM3X_OK)))
+        {
+            return STPM3X_ERROR;
+        }
+    }
+
+    stpm3x_calib_seal(calib);
+
+    return STPM3X_OK;
+}
+
+#ifdef MODULE_MTD
+int stpm3x_calib_load(stpm3x_t *dev, mtd_dev_t *mtd, uint32_t addr)
+{
+    assert(dev && mtd);
+
+    stpm3x_calib_t calib;
+
+    if ((mtd_read(mtd, &calib, addr, sizeof(calib)) >= 0) && (stpm3x_calib_apply(dev, &calib) == STPM3X_OK))
+    {
+        return STPM3X_OK;
+    }
+
+    DEBUG("%s : no calibration record at 0x%lx, reset values applied\n", DEBUG_FUNC, (unsigned long)addr);
+    stpm3x_calib_default(&calib);
+    stpm3x_calib_apply(dev, &calib);
+
+    return STPM3X_ERROR;
+}
+
+int stpm3x_calib_store(const stpm3x_calib_t *calib, mtd_dev_t *mtd, uint32_t addr)
+{
+    assert(calib && mtd);
+
+    const uint32_t sector = mtd->pages_per_sector * mtd->page_size;
+    stpm3x_calib_t check;
+
+    if (!stpm3x_calib_valid(calib))
+    {
+        return STPM3X_ERROR;
+    }
+
+    if ((mtd_erase(mtd, addr, sector) < 0) || (stpm3x_mtd_write(mtd, addr, calib, sizeof(*calib)) != STPM3X_OK) ||
+        (mtd_read(mtd, &check, addr, sizeof(check)) < 0) || (memcmp(&check, calib, sizeof(check)) != 0))
+    {
+        DEBUG("%s : could not store the calibration record at 0x%lx\n", DEBUG_FUNC, (unsigned long)addr);
+        return STPM3X_ERROR;
+    }
+
+    return STPM3X_OK;
+}
+#endif
@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2020 eeproperty Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     drivers_stpm3x
+ * @{
+ *
+ * @file
+ * @brief       Delta, zigzag and varint encoding of STPM3x sample streams
+ *              No RIOT dependency: this file can be built on the host to decode logs.
+ *
+ * @author      Joël Carron <jo.carron@cartondu.ch>
+ *
+ * @}
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "stpm3x_codec.h"
+
+/*
+ * Write a zigzag varint, return the number of bytes written or 0 if it does not fit
+ */
+static size_t _put_varint(int32_t value, uint8_t *buf, size_t len)
+{
+    uint32_t zz = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+    size_t i = 0;
+
+    do
+    {
+        if (i >= len)
+        {
+            return 0;
+        }
+
+        buf[i] = zz & 0x7F;
+        zz >>= 7;
+        buf[i] |= (zz) ? 0x80 : 0;
+        i++;
+    } while (zz);
+
+    return i;
+}
+
+/*
+ * Read a zigzag varint, return the number of bytes read or 0 if it is truncated or too long
+ */
+static size_t _get_varint(const uint8_t *buf, size_t len, int32_t *value)
+{
+    uint32_t zz = 0;
+
+    for (size_t i = 0; (i < len) && (i < 5); i++)
+    {
+        zz |= (uint32_t)(buf[i] & 0x7F) << (7 * i);
+
+        if (!(buf[i] & 0x80))
+        {
+            *value = (int32_t)((zz >> 1) ^ (0 - (zz & 1)));
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+void stpm3x_codec_init(stpm3x_codec_t *codec, uint16_t interval)
+{
+    memset(codec, 0, sizeof(*codec));
+    codec->interval = interval;
+}
+
+int stpm3x_codec_encode(stpm3x_codec_t *enc, const int32_t *fields, size_t count, uint8_t *buf, size_t len)
+{
+    if ((count == 0) || (count > STPM3X_CODEC_FIELDS_MAX))
+    {
+        return STPM3X_CODEC_ERR_FORMAT;
+    }
+    if (len == 0)
+    {
+        return STPM3X_CODEC_ERR_SPACE;
+    }
+
+    int key = (enc->fields != count) || (enc->since_key >= enc->interval);
+    size_t pos = 1;
+
+    buf[0] = (key ? STPM3X_CODEC_KEYFRAME : 0) | count;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        // differences wrap around like the values, the decoder wraps them back
+        int32_t value = (key) ? fields[i] : (int32_t)((uint32_t)fields[i] - (uint32_t)enc->prev[i]);
+        size_t n = _put_varint(value, buf + pos, len - pos);
+
+        if (n == 0)
+        {
+            return STPM3X_CODEC_ERR_SPACE;
+        }
+        pos += n;
+    }
+
+    memcpy(enc->prev, fields, count * sizeof(int32_t));
+    enc->fields = count;
+    enc->since_key = (key) ? 1 : enc->since_key + 1;
+
+    return pos;
+}
+
+int stpm3x_codec_decode(stpm3x_codec_t *dec, const uint8_t *buf, size_t len, int32_t *fields, size_t *count)
+{
+    if (len == 0)
+    {
+        return STPM3X_CODEC_ERR_SPACE;
+    }
+
+    int key = buf[0] & STPM3X_CODEC_KEYFRAME;
+    size_t num = buf[0] & ~STPM3X_CODEC_KEYFRAME;
+    size_t pos = 1;
+
+    if ((num == 0) || (num > STPM3X_CODEC_FIELDS_MAX) || (!key && (num != dec->fields)))
+    {
+        return STPM3X_CODEC_ERR_FORMAT;
+    }
+
+    for (size_t i = 0; i < num; i++)
+    {
+        int32_t value;
+        size_t n = _get_varint(buf + pos, len - pos, &value);
+
+        if (n == 0)
+        {
+            return STPM3X_CODEC_ERR_SPACE;
+        }
+        pos += n;
+
+        fields[i] = (key) ? value : (int32_t)((uint32_t)dec->prev[i] + (uint32_t)value);
+    }
+
+    memcpy(dec->prev, fields, num * sizeof(int32_t));
+    dec->fields = num;
+    *count = num;
+
+    return pos;
+}
@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2020 eeproperty Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     drivers_stpm3x
+ * @{
+ *
+ * @file
+ * @brief       Bus-partitioned acquisition of the STPM3x driver
+ *              One worker thread per bus, the snapshots of a round are merged into one frame.
+ *
+ * @author      Joël Carron <jo.carron@cartondu.ch>
+ *
+ * @}
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "assert.h"
+#include "mutex.h"
+
+#include "stpm3x.h"
+#include "stpm3x_time.h"
+
+#define ENABLE_DEBUG    (DEBUG_MODE)
+#include "debug.h"
+
+static bool _same_bus(const stpm3x_t *a, const stpm3x_t *b)
+{
+    if (a->transport != b->transport)
+    {
+        return false;
+    }
+
+#ifdef MODULE_PERIPH_UART
+    if (a->transport == &stpm3x_transport_uart)
+    {
+        return a->params.uart == b->params.uart;
+    }
+#endif
+
+    return a->params.spi == b->params.spi;
+}
+
+/*
+ * Completion callback, called from the worker threads
+ */
+static void _done_cb(stpm3x_req_t *req, void *arg)
+{
+    stpm3x_engine_t *engine = arg;
+    unsigned i = req - engine->req;
+
+    if (req->res != STPM3X_OK)
+    {
+        atomic_fetch_or(&engine->failed, 1UL << i);
+    }
+
+    // the last request done closes the frame, the others only filled their slot
+    if (atomic_fetch_sub(&engine->pending, 1) == 1)
+    {
+        stpm3x_frame_t *frame = engine->frame;
+
+        frame->latency = stpm3x_time_now() - frame->time;
+        frame->failed = atomic_load(&engine->failed);
+        mutex_unlock(&engine->done);
+    }
+}
+
+int stpm3x_engine_init(stpm3x_engine_t *engine, stpm3x_t *devs, size_t numof, uint8_t prio)
+{
+    assert(engine && devs && (numof <= STPM3X_ENGINE_MAX_DEVS));
+
+    const mutex_t locked = MUTEX_INIT_LOCKED;
+    size_t first[STPM3X_ENGINE_MAX_BUSES];
+
+    engine->devs = devs;
+    engine->numof = numof;
+    engine->buses = 0;
+    engine->frame = NULL;
+    engine->done = locked;
+    engine->seq = 0;
+    stpm3x_jitter_reset(&engine->jitter);
+    atomic_init(&engine->pending, 0);
+    atomic_init(&engine->failed, 0);
+
+    for (size_t i = 0; i < numof; i++)
+    {
+        unsigned b = 0;
+
+        // a bus is known by its first device
+        while ((b < engine->buses) && !_same_bus(&devs[i], &devs[first[b]]))
+        {
+            b++;
+        }
+
+        if (b == engine->buses)
+        {
+            if (b == STPM3X_ENGINE_MAX_BUSES)
+            {
+                DEBUG("%s : more than %u buses\n", DEBUG_FUNC, STPM3X_ENGINE_MAX_BUSES);
+                return STPM3X_ERROR;
+            }
+
+            first[b] = i;
+            engine->buses++;
+        }
+
+        engine->bus_of[i] = b;
+        engine->req[i].dev = &devs[i];
+        engine->req[i].type = STPM3X_REQ_SNAPSHOT;
+        engine->req[i].cb = _done_cb;
+        engine->req[i].arg = engine;
+    }
+
+    for (unsigned b = 0; b < engine->buses; b++)
+    {
+        if (stpm3x_async_init(&engine->bus[b], engine->stack[b], STPM3X_ENGINE_STACKSIZE, prio, "stpm3x_bus") != STPM3X_OK)
+        {
+            return STPM3X_ERROR;
+        }
+    }
+
+    DEBUG("%s : %u devices on %u buses\n", DEBUG_FUNC, (unsigned)numof, engine->buses);
+
+    return STPM3X_OK;
+}
+
+int stpm3x_engine_round(stpm3x_engine_t *engine, stpm3x_frame_t *frame)
+{
+    assert(engine && frame);
+
+    if (engine->numof == 0)
+    {
+        return STPM3X_OK;
+    }
+
+    frame->seq = engine->seq++;
+    frame->time = stpm3x_time_now();
+    stpm3x_jitter_add(&engine->jitter, frame->time);
+    engine->frame = frame;
+    atomic_store(&engine->failed, 0);
+    atomic_store(&engine->pending, engine->numof);
+
+    // each worker is kicked by the first request of its bus and reads while the next ones are submitted
+    for (size_t i = 0; i < engine->numof; i++)
+    {
+        engine->req[i].snap = &frame->snap[i];
+        stpm3x_async_submit(&engine->bus[engine->bus_of[i]], &engine->req[i]);
+    }
+
+    mutex_lock(&engine->done);
+
+    return (frame->failed) ? STPM3X_ERROR : STPM3X_OK;
+}
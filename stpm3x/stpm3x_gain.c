@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2020 eeproperty Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     drivers_stpm3x
+ * @{
+ *
+ * @file
+ * @brief       Current gain autoranging of the STPM3x driver
+ *
+ * @author      Joël Carron <jo.carron@cartondu.ch>
+ *
+ * @}
+ */
+
+#include <stdint.h>
+
+#include "assert.h"
+#include "mutex.h"
+
+#include "stpm3x.h"
+#include "stpm3x_internals.h"
+#include "stpm3x_regmap.h"
+#include "stpm3x_time.h"
+
+/**
+ * @brief Full scale of the 17 bits current RMS values
+ */
+#define C_RMS_FULL_SCALE        (0x1FFFFUL)
+
+/*
+ * Gain the LSB values of the parameters are given for
+ */
+static uint8_t _params_gain(const stpm3x_t *dev)
+{
+    switch (dev->params.gain)
+    {
+        case 4:
+        case 8:
+        case 16:
+            return dev->params.gain;
+        default:
+            return 2;
+    }
+}
+
+uint8_t stpm3x_set_gain(stpm3x_t *dev, unsigned channel, uint8_t gain)
+{
+    assert(dev && (channel < STPM3X_CHANNELS));
+
+    static const uint8_t regs[2] = { STPM3X_REG_DFE_CR1, STPM3X_REG_DFE_CR2 };
+    uint32_t code;
+
+    switch (gain)
+    {
+        case 2:
+            code = 0;
+            break;
+        case 4:
+            code = 1;
+            break;
+        case 8:
+            code = 2;
+            break;
+        case 16:
+            code = 3;
+            break;
+        default:
+            return STPM3X_ERROR;
+    }
+
+    mutex_lock(&dev->lock);
+
+    // the gain is in the MSB half of DFE_CRx: one frame is enough
+    uint32_t row = (dev->shadow[regs[channel] / 2] & ~STPM3X_MASK_GAIN1) | (code << 26);
+
+    if (stpm3x_write_half(dev, regs[channel] + 1, row >> 16) != STPM3X_OK)
+    {
+        mutex_unlock(&dev->lock);
+        return STPM3X_ERROR;
+    }
+
+    // the current LSB is inversely proportional to the gain, so are the ones derived from it
+    double ratio = (double)_params_gain(dev) / gain;
+    dev->lsb.current[channel] = dev->params.currentRMSLSBValue * ratio * 1000000;
+#if IS_USED(MODULE_STPM3X_POWER)
+    dev->lsb.power[channel] = dev->params.powerLSBValue * ratio * 1000000;
+#endif
+#if IS_USED(MODULE_STPM3X_ENERGY)
+    dev->lsb.energy[channel] = dev->params.energyLSBValue * ratio * 1000000000;
+    dev->lsb.charge[channel] = dev->params.chargeLSBValue * ratio * 1000000000;
+#endif
+
+    dev->gain[channel] = gain;
+    dev->gain_time[channel] = stpm3x_time_now();
+    dev->ranging |= (1 << channel);
+
+    mutex_unlock(&dev->lock);
+
+    return STPM3X_OK;
+}
+
+uint8_t stpm3x_autorange(stpm3x_t *dev, const stpm3x_snapshot_t *snap, const stpm3x_autorange_t *range)
+{
+    assert(dev && snap && range);
+
+    const uint32_t rms[2] = {
+        stpm3x_get_C1_RMS(snap->reg[STPM3X_SNAP_RMS1]), stpm3x_get_C2_RMS(snap->reg[STPM3X_SNAP_RMS2])
+    };
+    uint8_t switched = 0;
+
+    for (unsigned i = 0; i < STPM3X_CHANNELS; i++)
+    {
+        // the RMS value of a channel still settling does not reflect its gain
+        if (snap->ranging & (1 << i))
+        {
+            continue;
+        }
+
+        uint32_t level = (rms[i] * 1000) / C_RMS_FULL_SCALE;
+        uint8_t gain = dev->gain[i];
+
+        if ((level > range->high) && (gain > 2))
+        {
+            gain /= 2;
+        }
+        else if ((level < range->low) && (gain < 16))
+        {
+            gain *= 2;
+        }
+
+        if ((gain != dev->gain[i]) && (stpm3x_set_gain(dev, i, gain) == STPM3X_OK))
+        {
+            switched |= (1 << i);
+        }
+    }
+
+    return switched;
+}
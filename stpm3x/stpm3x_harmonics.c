@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2020 eeproperty Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     drivers_stpm3x
+ * @{
+ *
+ * @file
+ * @brief       Harmonic analysis of waveforms captured from the STPM3x
+ *              A fixed-point Goertzel filter is run on the fundamental and its harmonics.
+ *              With the cmsis-dsp package, the DC and RMS values of the window use its vectorized functions.
+ *
+ * @author      Joël Carron <jo.carron@cartondu.ch>
+ *
+ * @}
+ */
+
+#include <stdint.h>
+
+#include "assert.h"
+#include "kernel_defines.h"
+
+#include "stpm3x.h"
+#include "stpm3x_internals.h"
+#include "stpm3x_math.h"
+#include "stpm3x_regmap.h"
+
+#ifdef MODULE_CMSIS_DSP
+#include "arm_math.h"
+#endif
+
+/*
+ * Mean and mean square of the window
+ */
+static void _moments(const int32_t *samples, size_t count, int32_t *mean, uint64_t *mean_sq)
+{
+#ifdef MODULE_CMSIS_DSP
+    q31_t m;
+    q63_t power;
+
+    arm_mean_q31((q31_t *)samples, count, &m);
+    // products are truncated by 14 bits in the 2.48 format of arm_power_q31()
+    arm_power_q31((q31_t *)samples, count, &power);
+
+    *mean = m;
+    *mean_sq = ((uint64_t)power << 14) / count;
+#else
+    int64_t sum = 0;
+    uint64_t sum_sq = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        sum += samples[i];
+        sum_sq += (int64_t)samples[i] * samples[i];
+    }
+
+    *mean = sum / (int64_t)count;
+    *mean_sq = sum_sq / count;
+#endif
+}
+
+/*
+ * Magnitude of the DFT of the window at the given phase step per sample
+ */
+static uint64_t _goertzel(const int32_t *samples, size_t count, int32_t mean, uint32_t step)
+{
+    // 2 * cos(w) in Q30
+    const int64_t coeff = (int64_t)stpm3x_cos_q30(step) * 2;
+    // sin(w) in Q30
+    int64_t sin = stpm3x_cos_q30(step - STPM3X_ANGLE_QUARTER);
+    sin = (sin < 0) ? -sin : sin;
+
+    if (sin == 0)
+    {
+        return 0;
+    }
+
+    // The state grows up to N * |x| / (2 * sin(w)), with |x| < 2^25 once the mean is removed:
+    // samples are shifted so that the state stays below 2^30 and its square fits in 64 bits.
+    unsigned shift = 0;
+    while ((((uint64_t)count << 25) >> shift) > (uint64_t)(2 * sin))
+    {
+        shift++;
+    }
+
+    int64_t s1 = 0;
+    int64_t s2 = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        int64_t s0 = ((samples[i] - mean) >> shift) + ((coeff * s1) >> 30) - s2;
+        s2 = s1;
+        s1 = s0;
+    }
+
+    int64_t power = (s1 * s1) + (s2 * s2) - (((coeff * s1) >> 30) * s2);
+
+    return (power > 0) ? ((uint64_t)stpm3x_isqrt(power) << shift) : 0;
+}
+
+/*
+ * Ratio of two magnitudes in [0.01 %]
+ */
+static uint64_t _ratio(uint64_t num, uint64_t den)
+{
+    while (num > (UINT64_MAX / 10000))
+    {
+        num >>= 1;
+        den >>= 1;
+    }
+
+    return (den) ? (num * 10000) / den : 0;
+}
+
+int stpm3x_harmonics_compute(const int32_t *samples, size_t count, uint32_t sample_us, uint32_t period_us,
+                             stpm3x_harmonics_t *res)
+{
+    assert(samples && res && (count <= STPM3X_HARMONICS_MAX_SAMPLES));
+
+    // the fundamental must be below half of the sampling rate
+    if ((count == 0) || ((2 * sample_us) >= period_us))
+    {
+        return STPM3X_ERROR;
+    }
+
+    int32_t mean;
+    uint64_t mean_sq;
+    _moments(samples, count, &mean, &mean_sq);
+
+    uint64_t dc_sq = (int64_t)mean * mean;
+    res->rms = stpm3x_isqrt((mean_sq > dc_sq) ? (mean_sq - dc_sq) : 0);
+
+    // phase step of the fundamental between two samples
+    uint32_t step = ((uint64_t)sample_us << 32) / period_us;
+    uint64_t fund = _goertzel(samples, count, mean, step);
+
+    // amplitude = 2 * |X| / N
+    res->fundamental = (fund * 2) / count;
+
+    uint64_t sum_sq = 0;
+
+    for (unsigned h = 2; h < STPM3X_HARMONICS_NUMOF + 2; h++)
+    {
+        uint64_t ratio = 0;
+
+        // harmonics above half of the sampling rate cannot be analysed
+        if ((2 * h * sample_us) < period_us)
+        {
+            ratio = _ratio(_goertzel(samples, count, mean, step * h), fund);
+        }
+
+        sum_sq += ratio * ratio;
+        res->harmonic[h - 2] = (ratio > UINT16_MAX) ? UINT16_MAX : ratio;
+    }
+
+    uint32_t thd = stpm3x_isqrt(sum_sq);
+    res->thd = (thd > UINT16_MAX) ? UINT16_MAX : thd;
+
+    return STPM3X_OK;
+}
+
+uint8_t stpm3x_read_harmonic_share(stpm3x_t *dev, int16_t share[2])
+{
+    static const uint8_t fields[] = {
+        STPM3X_FIELD_PH1_ACTIVE_POWER, STPM3X_FIELD_PH1_FUNDAMENTAL_POWER,
+        STPM3X_FIELD_PH2_ACTIVE_POWER, STPM3X_FIELD_PH2_FUNDAMENTAL_POWER
+    };
+    int32_t values[ARRAY_SIZE(fields)];
+
+    uint8_t res = stpm3x_read_fields(dev, fields, ARRAY_SIZE(fields), values);
+
+    for (unsigned i = 0; i < 2; i++)
+    {
+        int64_t active = values[2 * i];
+        int64_t fundamental = values[(2 * i) + 1];
+
+        int64_t value = (active) ? ((active - fundamental) * 10000) / active : 0;
+
+        // P_fund can exceed P by far at low load: saturate like the 16 bits getters
+        share[i] = (value > INT16_MAX) ? INT16_MAX : ((value < INT16_MIN) ? INT16_MIN : value);
+    }
+
+    return res;
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2020 eeproperty Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     drivers_stpm3x
+ * @{
+ *
+ * @file
+ * @brief       Integer math helpers of the STPM3x driver
+ *
+ * @author      Joël Carron <jo.carron@cartondu.ch>
+ *
+ * @}
+ */
+
+#include <stdint.h>
+
+#include "stpm3x_math.h"
+
+/**
+ * @brief One in Q30 format
+ */
+#define Q30_ONE                     (1L << 30)
+
+/**
+ * @brief Quarter of a turn in [rad], Q30 format
+ */
+#define Q30_HALF_PI                 (1686629713L)
+
+/*
+ * Cosine and sine of x in [rad] Q30, 0 <= x <= pi/4, by their Taylor series.
+ * The first neglected terms are below 3e-8 on this interval.
+ */
+static int32_t _cos_octant(int64_t x)
+{
+    int64_t x2 = (x * x) >> 30;
+    int64_t t = Q30_ONE - (x2 / 56);
+
+    t = Q30_ONE - (((x2 * t) >> 30) / 30);
+    t = Q30_ONE - (((x2 * t) >> 30) / 12);
+    return Q30_ONE - (((x2 * t) >> 30) / 2);
+}
+
+static int32_t _sin_octant(int64_t x)
+{
+    int64_t x2 = (x * x) >> 30;
+    int64_t t = Q30_ONE - (x2 / 72);
+
+    t = Q30_ONE - (((x2 * t) >> 30) / 42);
+    t = Q30_ONE - (((x2 * t) >> 30) / 20);
+    t = Q30_ONE - (((x2 * t) >> 30) / 6);
+    return (x * t) >> 30;
+}
+
+/*
+ * Cosine of an angle of the first quadrant, angle in [1/2^32 turn] from 0 to 2^30
+ */
+static int32_t _cos_quadrant(uint32_t angle)
+{
+    if (angle > (STPM3X_ANGLE_QUARTER / 2))
+    {
+        return _sin_octant(((int64_t)(STPM3X_ANGLE_QUARTER - angle) * Q30_HALF_PI) >> 30);
+    }
+
+    return _cos_octant(((int64_t)angle * Q30_HALF_PI) >> 30);
+}
+
+int32_t stpm3x_cos_q30(uint32_t angle)
+{
+    uint32_t in_quadrant = angle & (STPM3X_ANGLE_QUARTER - 1);
+
+    switch (angle >> 30)
+    {
+        case 0:
+            return _cos_quadrant(in_quadrant);
+        case 1:
+            return -_cos_quadrant(STPM3X_ANGLE_QUARTER - in_quadrant);
+        case 2:
+            return -_cos_quadrant(in_quadrant);
+        default:
+            return _cos_quadrant(STPM3X_ANGLE_QUARTER - in_quadrant);
+    }
+}
+
+/**
+ * @brief Cosine of a quarter turn in 64 steps, Q15 format
+ */
+static const int16_t _cos_table[65] = {
+    32767, 32757, 32728, 32678, 32609, 32521, 32412, 32285,
+    32137, 31971, 31785, 31580, 31356, 31113, 30852, 30571,
+    30273, 29956, 29621, 29268, 28898, 28510, 28105, 27683,
+    27245, 26790, 26319, 25832, 25329, 24811, 24279, 23731,
+    23170, 22594, 22005, 21403, 20787, 20159, 19519, 18868,
+    18204, 17530, 16846, 16151, 15446, 14732, 14010, 13279,
+    12539, 11793, 11039, 10278,  9512,  8739,  7962,  7179,
+     6393,  5602,  4808,  4011,  3212,  2410,  1608,   804,
+        0,
+};
+
+/*
+ * Cosine of an angle of the first quadrant by linear interpolation, angle in [1/2^32 turn] from 0 to 2^30
+ */
+static int16_t _cos_table_quadrant(uint32_t angle)
+{
+    uint32_t index = angle >> 24;
+    int32_t frac = (angle >> 8) & 0xFFFF;
+
+    if (index >= 64)
+    {
+        return _cos_table[64];
+    }
+
+    return _cos_table[index] + (((_cos_table[index + 1] - _cos_table[index]) * frac) >> 16);
+}
+
+int16_t stpm3x_cos_q15(uint32_t angle)
+{
+    uint32_t in_quadrant = angle & (STPM3X_ANGLE_QUARTER - 1);
+
+    switch (angle >> 30)
+    {
+        case 0:
+            return _cos_table_quadrant(in_quadrant);
+        case 1:
+            return -_cos_table_quadrant(STPM3X_ANGLE_QUARTER - in_quadrant);
+        case 2:
+            return -_cos_table_quadrant(in_quadrant);
+        default:
+            return _cos_table_quadrant(STPM3X_ANGLE_QUARTER - in_quadrant);
+    }
+}
+
+uint32_t stpm3x_isqrt(uint64_t value)
+{
+    uint64_t res = 0;
+    uint64_t bit = 1ULL << 62;
+
+    while (bit > value)
+    {
+        bit >>= 2;
+    }
+
+    while (bit)
+    {
+        if (value >= res + bit)
+        {
+            value -= res + bit;
+            res = (res >> 1) + bit;
+        }
+        else
+        {
+            res >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return (uint32_t)res;
+}
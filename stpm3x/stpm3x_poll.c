@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2020 eeproperty Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     drivers_stpm3x
+ * @{
+ *
+ * @file
+ * @brief       Adaptive polling of the STPM3x
+ *              The poll interval backs off while the readings are steady.
+ *
+ * @author      Joël Carron <jo.carron@cartondu.ch>
+ *
+ * @}
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "assert.h"
+#include "kernel_defines.h"
+#include "mutex.h"
+
+#include "stpm3x.h"
+#include "stpm3x_internals.h"
+#include "stpm3x_time.h"
+
+#define ENABLE_DEBUG    (DEBUG_MODE)
+#include "debug.h"
+
+/*
+ * Status flags of DSP_SR1 (channel 1) or DSP_SR2 (channel 2) for the given events
+ */
+static uint32_t _event_flags(uint8_t events, unsigned channel)
+{
+    uint32_t flags = 0;
+
+    if (events & STPM3X_POLL_EV_SAG)
+    {
+        flags |= STPM3X_MASK_SR_V1_SAG_START;
+    }
+    if (events & STPM3X_POLL_EV_SWELL)
+    {
+        flags |= STPM3X_MASK_SR_V1_SWELL_START | STPM3X_MASK_SR_C1_SWELL_START;
+    }
+    if (events & STPM3X_POLL_EV_SIGN)
+    {
+        flags |= (channel == 0) ? STPM3X_MASK_SR_PH1_POWER_SIGN_A : STPM3X_MASK_SR_PH2_POWER_SIGN_A;
+    }
+
+    return flags;
+}
+
+static bool _out_of_band(int32_t value, int32_t ref, uint32_t deadband)
+{
+    int64_t diff = (int64_t)value - ref;
+
+    return ((diff < 0) ? -diff : diff) > deadband;
+}
+
+static void _kick_cb(void *arg)
+{
+    stpm3x_poll_kick(arg);
+}
+
+int stpm3x_poll_init(stpm3x_poll_t *poll, stpm3x_t *dev, const stpm3x_poll_config_t *config)
+{
+    assert(poll && dev && config && (config->min_interval <= config->max_interval));
+
+    static const uint8_t irq_regs[2] = { STPM3X_REG_DSP_IRQ1, STPM3X_REG_DSP_IRQ2 };
+    const mutex_t locked = MUTEX_INIT_LOCKED;
+
+    poll->dev = dev;
+    poll->config = *config;
+    poll->wake = locked;
+    poll->interval = config->min_interval;
+
+    // the INT1/INT2 pins belong to stpm3x_irq, without it the events are left out
+    if (IS_USED(MODULE_STPM3X_IRQ) && config->events)
+    {
+        mutex_lock(&dev->lock);
+
+        for (unsigned i = 0; i < 2; i++)
+        {
+            uint32_t row = 0;
+            stpm3x_read_reg(dev, irq_regs[i], &row);
+            row |= _event_flags(config->events, i);
+            stpm3x_write_reg(dev, irq_regs[i], &row);
+        }
+
+        mutex_unlock(&dev->lock);
+
+        const gpio_t pins[2] = { dev->params.int1, dev->params.int2 };
+
+        for (unsigned i = 0; i < 2; i++)
+        {
+            if ((pins[i] != GPIO_UNDEF) && (gpio_init_int(pins[i], GPIO_IN, GPIO_RISING, _kick_cb, poll) != 0))
+            {
+                DEBUG("%s: could not initialize GPIO INT%u pin\n", DEBUG_FUNC, i + 1);
+                return STPM3X_ERROR_GPIO;
+            }
+        }
+    }
+
+    stpm3x_read_measure(dev, &poll->ref);
+    poll->last = stpm3x_time_now();
+
+    return STPM3X_OK;
+}
+
+void stpm3x_poll_kick(stpm3x_poll_t *poll)
+{
+    mutex_unlock(&poll->wake);
+}
+
+int stpm3x_poll_next(stpm3x_poll_t *poll, stpm3x_measure_t *measure)
+{
+    assert(poll && measure);
+
+    const stpm3x_poll_config_t *config = &poll->config;
+    uint32_t elapsed = stpm3x_time_now() - poll->last;
+    bool kicked;
+
+    if (elapsed < poll->interval)
+    {
+        kicked = (stpm3x_time_lock_timeout(&poll->wake, poll->interval - elapsed) == 0);
+    }
+    else
+    {
+        // a kick received while no one was waiting left the mutex unlocked
+        kicked = mutex_trylock(&poll->wake);
+    }
+
+    int res = (kicked) ? STPM3X_POLL_EVENT : STPM3X_POLL_STEADY;
+
+    if (IS_USED(MODULE_STPM3X_IRQ) && kicked && config->events)
+    {
+        static const uint8_t sr_regs[2] = { STPM3X_REG_DSP_SR1, STPM3X_REG_DSP_SR2 };
+        uint32_t status[2];
+
+        // status flags are cleared by writing them back: the INT pins are released
+        stpm3x_read_regs(poll->dev, sr_regs, status, 2);
+
+        for (unsigned i = 0; i < 2; i++)
+        {
+            uint32_t flags = status[i] & _event_flags(config->events, i);
+
+            if (flags)
+            {
+                stpm3x_write_reg(poll->dev, sr_regs[i], &flags);
+            }
+        }
+    }
+
+    stpm3x_read_measure(poll->dev, measure);
+    poll->last = stpm3x_time_now();
+
+    if (res == STPM3X_POLL_STEADY)
+    {
+        for (unsigned i = 0; i < 2; i++)
+        {
+            if (_out_of_band(measure->voltage[i], poll->ref.voltage[i], config->deadband_v) ||
+                _out_of_band(measure->current[i], poll->ref.current[i], config->deadband_c) ||
+                _out_of_band(measure->power[i], poll->ref.power[i], config->deadband_p))
+            {
+                res = STPM3X_POLL_CHANGE;
+            }
+        }
+    }
+
+    if (res == STPM3X_POLL_STEADY)
+    {
+        // exponential back-off, the reference stays so that a slow drift is caught too
+        poll->interval = (poll->interval > (config->max_interval / 2)) ? config->max_interval : poll->interval * 2;
+    }
+    else
+    {
+        poll->interval = config->min_interval;
+        poll->ref = *measure;
+    }
+
+    return res;
+}
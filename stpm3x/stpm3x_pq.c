@@ -0,0 +1,360 @@
+/*
+ * Copyright (C) 2020 eeproperty Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     drivers_stpm3x
+ * @{
+ *
+ * @file
+ * @brief       Power quality event recorder of the STPM3x driver
+ *              Sag and swell flags latched by the chip are turned into timestamped events.
+ *
+ * @author      Joël Carron <jo.carron@cartondu.ch>
+ *
+ * @}
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "assert.h"
+#include "kernel_defines.h"
+#include "mutex.h"
+
+#include "stpm3x.h"
+#include "stpm3x_internals.h"
+#include "stpm3x_time.h"
+
+#define ENABLE_DEBUG    (DEBUG_MODE)
+#include "debug.h"
+
+/**
+ * @brief Index of the registers read by stpm3x_pq_poll()
+ */
+enum {
+    _SR1 = 0,
+    _SR2,
+    _REG16,
+    _REG17,
+    _REG18,
+    _REG19,
+    _NUMOF
+};
+
+static const uint8_t _poll_regs[_NUMOF] = {
+    [_SR1]   = STPM3X_REG_DSP_SR1,
+    [_SR2]   = STPM3X_REG_DSP_SR2,
+    [_REG16] = STPM3X_REG_DSP_REG16,
+    [_REG17] = STPM3X_REG_DSP_REG17,
+    [_REG18] = STPM3X_REG_DSP_REG18,
+    [_REG19] = STPM3X_REG_DSP_REG19,
+};
+
+/**
+ * @brief Flags and duration field of one kind of event, for channel 1
+ *
+ * The status flags of channel 2 are at the same place in DSP_SR2,
+ * its durations two registers further.
+ */
+typedef struct {
+    uint32_t start;                 /**< start flag in DSP_SR1 */
+    uint32_t end;                   /**< end flag in DSP_SR1 */
+    uint8_t reg;                    /**< index of the duration register */
+    uint8_t shift;                  /**< position of the 15 bits duration */
+} _event_def_t;
+
+static const _event_def_t _events[] = {
+    [STPM3X_PQ_SAG] = {
+        STPM3X_MASK_SR_V1_SAG_START, STPM3X_MASK_SR_V1_SAG_END, _REG16, 16
+    },
+    [STPM3X_PQ_SWELL_V] = {
+        STPM3X_MASK_SR_V1_SWELL_START, STPM3X_MASK_SR_V1_SWELL_END, _REG16, 0
+    },
+    [STPM3X_PQ_SWELL_C] = {
+        STPM3X_MASK_SR_C1_SWELL_START, STPM3X_MASK_SR_C1_SWELL_END, _REG17, 0
+    },
+};
+
+/**
+ * @brief Status flags handled by the recorder
+ */
+#define PQ_FLAGS        (STPM3X_MASK_SR_V1_SAG_START | STPM3X_MASK_SR_V1_SAG_END | \
+                         STPM3X_MASK_SR_V1_SWELL_START | STPM3X_MASK_SR_V1_SWELL_END | \
+                         STPM3X_MASK_SR_C1_SWELL_START | STPM3X_MASK_SR_C1_SWELL_END)
+
+/*
+ * Replace a field of a register, called with dev->lock held.
+ * A register which could not be read is not written back.
+ */
+static uint8_t _update_reg(stpm3x_t *dev, uint8_t reg, uint32_t mask, uint32_t value)
+{
+    uint32_t row = 0;
+    uint8_t res = stpm3x_read_reg(dev, reg, &row);
+
+    if (res != STPM3X_OK)
+    {
+        return res;
+    }
+
+    row = (row & ~mask) | (value & mask);
+    return stpm3x_write_reg(dev, reg, &row);
+}
+
+/*
+ * Raw 10 bits threshold from a value in milli-units and the LSB of the RMS value in nano-units
+ */
+static uint32_t _threshold(uint32_t milli, uint32_t lsb, unsigned shift)
+{
+    uint64_t raw = (lsb) ? (((uint64_t)milli * 1000000) / lsb) >> shift : 0;
+
+    return (raw > 0x3FF) ? 0x3FF : raw;
+}
+
+static void _push(stpm3x_pq_t *pq, uint8_t type, uint8_t channel, uint8_t end, uint32_t time, uint32_t duration)
+{
+    if (pq->count == STPM3X_PQ_RING_SIZE)
+    {
+        // the oldest event is dropped, the next one stored carries the count
+        pq->count--;
+        pq->lost = (pq->lost < UINT8_MAX) ? pq->lost + 1 : UINT8_MAX;
+    }
+
+    stpm3x_pq_event_t *event = &pq->ring[pq->head];
+    event->seq = pq->seq++;
+    event->time = time;
+    event->duration = duration;
+    event->type = type;
+    event->channel = channel;
+    event->end = end;
+    event->lost = pq->lost;
+
+    pq->lost = 0;
+    pq->head = (pq->head + 1) % STPM3X_PQ_RING_SIZE;
+    pq->count++;
+}
+
+int stpm3x_pq_init(stpm3x_pq_t *pq, stpm3x_t *dev, gpio_cb_t cb, void *arg)
+{
+    assert(pq && dev);
+
+    memset(pq, 0, sizeof(*pq));
+    mutex_init(&pq->lock);
+    pq->dev = dev;
+
+    if (cb == NULL)
+    {
+        return STPM3X_OK;
+    }
+
+    const gpio_t pins[2] = { dev->params.int1, dev->params.int2 };
+
+    for (unsigned i = 0; i < 2; i++)
+    {
+        if ((pins[i] != GPIO_UNDEF) && (gpio_init_int(pins[i], GPIO_IN, GPIO_RISING, cb, arg) != 0))
+        {
+            DEBUG("%s: could not initialize GPIO INT%u pin\n", DEBUG_FUNC, i + 1);
+            return STPM3X_ERROR_GPIO;
+        }
+    }
+
+    return STPM3X_OK;
+}
+
+uint8_t stpm3x_pq_config(stpm3x_pq_t *pq, const stpm3x_pq_config_t *config)
+{
+    assert(pq && config);
+
+    stpm3x_t *dev = pq->dev;
+    const uint8_t v_regs[2] = { STPM3X_REG_DSP_CR5, STPM3X_REG_DSP_CR7 };
+    const uint8_t c_regs[2] = { STPM3X_REG_DSP_CR6, STPM3X_REG_DSP_CR8 };
+    const uint8_t irq_regs[2] = { STPM3X_REG_DSP_IRQ1, STPM3X_REG_DSP_IRQ2 };
+    uint8_t res;
+
+    // the read-modify-writes must not interleave with the latches of DSP_CR3
+    mutex_lock(&dev->lock);
+
+    uint32_t sag_time = config->sag_time / STPM3X_SAG_TIME_THR_LSB_US;
+    sag_time = (sag_time > STPM3X_MASK_SAG_TIME_THR) ? STPM3X_MASK_SAG_TIME_THR : sag_time;
+    res = _update_reg(dev, STPM3X_REG_DSP_CR3, STPM3X_MASK_SAG_TIME_THR, sag_time);
+
+    for (unsigned i = 0; (i < STPM3X_CHANNELS) && (res == STPM3X_OK); i++)
+    {
+        uint32_t irq = 0;
+
+        // a swell threshold at its maximum is never reached
+        uint32_t sag = _threshold(config->sag[i], dev->lsb.voltage, STPM3X_THR_V_SHIFT);
+        uint32_t swell_v = (config->swell_v[i]) ?
+                           _threshold(config->swell_v[i], dev->lsb.voltage, STPM3X_THR_V_SHIFT) : 0x3FF;
+        uint32_t swell_c = (config->swell_c[i]) ?
+                           _threshold(config->swell_c[i], dev->lsb.current[i], STPM3X_THR_C_SHIFT) : 0x3FF;
+
+        res = _update_reg(dev, v_regs[i], STPM3X_MASK_SWV_THR1 | STPM3X_MASK_SAG_THR1, (swell_v << 12) | (sag << 22));
+        res = (res == STPM3X_OK) ? _update_reg(dev, c_regs[i], STPM3X_MASK_SWC_THR1, swell_c << 12) : res;
+
+        if (config->sag[i])
+        {
+            irq |= _events[STPM3X_PQ_SAG].start | _events[STPM3X_PQ_SAG].end;
+        }
+        if (config->swell_v[i])
+        {
+            irq |= _events[STPM3X_PQ_SWELL_V].start | _events[STPM3X_PQ_SWELL_V].end;
+        }
+        if (config->swell_c[i])
+        {
+            irq |= _events[STPM3X_PQ_SWELL_C].start | _events[STPM3X_PQ_SWELL_C].end;
+        }
+
+        res = (res == STPM3X_OK) ? _update_reg(dev, irq_regs[i], PQ_FLAGS, irq) : res;
+    }
+
+    mutex_unlock(&dev->lock);
+
+    return res;
+}
+
+unsigned stpm3x_pq_poll(stpm3x_pq_t *pq)
+{
+    assert(pq);
+
+    uint32_t values[_NUMOF];
+    unsigned count = 0;
+
+    uint32_t now;
+
+    // the events are dated by the latch of the status registers
+    stpm3x_read_latched_time(pq->dev, _poll_regs, values, _NUMOF, &now);
+
+    // status flags are cleared by writing them back, flags raised since the read stay set
+    for (unsigned i = 0; i < 2; i++)
+    {
+        uint32_t flags = values[_SR1 + i] & PQ_FLAGS;
+
+        if (flags)
+        {
+            stpm3x_write_reg(pq->dev, _poll_regs[_SR1 + i], &flags);
+        }
+    }
+
+    mutex_lock(&pq->lock);
+
+    for (unsigned i = 0; i < 2; i++)
+    {
+        uint32_t flags = values[_SR1 + i];
+
+        for (unsigned type = 0; type < ARRAY_SIZE(_events); type++)
+        {
+            const _event_def_t *def = &_events[type];
+
+            // an event shorter than the poll period has both flags: the start comes first
+            if (flags & def->start)
+            {
+                _push(pq, type, i, 0, now, 0);
+                count++;
+            }
+            if (flags & def->end)
+            {
+                uint32_t duration = (values[def->reg + (2 * i)] >> def->shift) & 0x7FFF;
+                _push(pq, type, i, 1, now, duration * STPM3X_EVENT_TIME_LSB_US);
+                count++;
+            }
+        }
+    }
+
+    mutex_unlock(&pq->lock);
+
+    return count;
+}
+
+int stpm3x_pq_pop(stpm3x_pq_t *pq, stpm3x_pq_event_t *event)
+{
+    assert(pq && event);
+
+    int res = STPM3X_ERROR;
+
+    mutex_lock(&pq->lock);
+
+    if (pq->count)
+    {
+        *event = pq->ring[(pq->head + STPM3X_PQ_RING_SIZE - pq->count) % STPM3X_PQ_RING_SIZE];
+        pq->count--;
+        res = STPM3X_OK;
+    }
+
+    mutex_unlock(&pq->lock);
+
+    return res;
+}
+
+#ifdef MODULE_MTD
+void stpm3x_pq_set_log(stpm3x_pq_t *pq, mtd_dev_t *mtd, uint32_t start, uint32_t size)
+{
+    assert(pq && mtd);
+
+    mutex_lock(&pq->lock);
+    pq->mtd = mtd;
+    pq->log_start = start;
+    pq->log_size = size;
+    pq->log_pos = start;
+    mutex_unlock(&pq->lock);
+}
+
+int stpm3x_pq_flush(stpm3x_pq_t *pq)
+{
+    assert(pq);
+
+    if (pq->mtd == NULL)
+    {
+        return STPM3X_ERROR;
+    }
+
+    int res = STPM3X_OK;
+
+    mutex_lock(&pq->lock);
+
+    const uint32_t sector = pq->mtd->pages_per_sector * pq->mtd->page_size;
+
+    while (pq->count && (res == STPM3X_OK))
+    {
+        // one batch stops at the end of the ring or of the sector
+        size_t first = (pq->head + STPM3X_PQ_RING_SIZE - pq->count) % STPM3X_PQ_RING_SIZE;
+        size_t numof = STPM3X_PQ_RING_SIZE - first;
+        size_t room = (sector - (pq->log_pos % sector)) / sizeof(stpm3x_pq_event_t);
+        numof = (pq->count < numof) ? pq->count : numof;
+        numof = (room < numof) ? room : numof;
+
+        if (((pq->log_pos % sector) == 0) && (mtd_erase(pq->mtd, pq->log_pos, sector) < 0))
+        {
+            DEBUG("%s : could not erase the log sector at 0x%lx\n", DEBUG_FUNC, (unsigned long)pq->log_pos);
+            res = STPM3X_ERROR;
+            break;
+        }
+
+        uint32_t size = numof * sizeof(stpm3x_pq_event_t);
+
+        // the batch can span several pages
+        if (stpm3x_mtd_write(pq->mtd, pq->log_pos, &pq->ring[first], size) != STPM3X_OK)
+        {
+            DEBUG("%s : could not write the log at 0x%lx\n", DEBUG_FUNC, (unsigned long)pq->log_pos);
+            res = STPM3X_ERROR;
+            break;
+        }
+
+        pq->count -= numof;
+        pq->log_pos += size;
+
+        if (pq->log_pos >= (pq->log_start + pq->log_size))
+        {
+            pq->log_pos = pq->log_start;
+        }
+    }
+
+    mutex_unlock(&pq->lock);
+
+    return res;
+}
+#endif
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2020 eeproperty Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     drivers_stpm3x
+ * @{
+ *
+ * @file
+ * @brief       Field map and burst planner of the STPM3x driver
+ *
+ * @author      Joël Carron <jo.carron@cartondu.ch>
+ *
+ * @}
+ */
+
+#include <stdint.h>
+
+#include "assert.h"
+
+#include "stpm3x.h"
+#include "stpm3x_internals.h"
+#include "stpm3x_regmap.h"
+
+const stpm3x_field_t stpm3x_fields[STPM3X_FIELD_NUMOF] = {
+#define STPM3X_FIELD_DESC(name, reg, mask, sign, unit, ch)      \
+    [STPM3X_FIELD_##name] = { (mask), (reg), (sign), (unit), (ch) },
+    STPM3X_FIELDS(STPM3X_FIELD_DESC)
+#undef STPM3X_FIELD_DESC
+};
+
+size_t stpm3x_plan_fields(const uint8_t *fields, size_t numof, uint8_t *regs, uint8_t *slots)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < numof; i++)
+    {
+        assert(fields[i] < STPM3X_FIELD_NUMOF);
+
+        uint8_t reg = stpm3x_fields[fields[i]].reg;
+        size_t slot = 0;
+
+        while ((slot < count) && (regs[slot] != reg))
+        {
+            slot++;
+        }
+
+        if (slot == count)
+        {
+            regs[count++] = reg;
+        }
+
+        slots[i] = slot;
+    }
+
+    return count;
+}
+
+uint8_t stpm3x_read_fields(stpm3x_t *dev, const uint8_t *fields, size_t numof, int32_t *values)
+{
+    assert(dev && fields && values && (numof <= STPM3X_FIELDS_MAX));
+
+    uint8_t regs[STPM3X_FIELDS_MAX];
+    uint8_t slots[STPM3X_FIELDS_MAX];
+    uint32_t raw[STPM3X_FIELDS_MAX];
+
+    size_t count = stpm3x_plan_fields(fields, numof, regs, slots);
+    uint8_t res = stpm3x_read_latched(dev, regs, raw, count);
+
+    for (size_t i = 0; i < numof; i++)
+    {
+        const stpm3x_field_t *field = &stpm3x_fields[fields[i]];
+
+        values[i] = stpm3x_field_extract(raw[slots[i]], field->mask, field->sign);
+    }
+
+    return res;
+}
+
+int64_t stpm3x_field_to_micro(const stpm3x_t *dev, uint8_t field, int32_t value)
+{
+    assert(dev && (field < STPM3X_FIELD_NUMOF));
+
+    const stpm3x_field_t *desc = &stpm3x_fields[field];
+
+    // no LSB values are kept for a channel compiled out
+    if (desc->channel >= STPM3X_CHANNELS)
+    {
+        return 0;
+    }
+
+    switch (desc->unit)
+    {
+        case STPM3X_UNIT_PERIOD:
+            return (int64_t)value * STPM3X_PERIOD_LSB_US;
+        case STPM3X_UNIT_EVENT:
+            return (int64_t)value * STPM3X_EVENT_TIME_LSB_US;
+        // LSB values in nano-units
+        case STPM3X_UNIT_VOLTAGE:
+            return ((int64_t)value * dev->lsb.voltage) / 1000;
+        case STPM3X_UNIT_CURRENT:
+            return ((int64_t)value * dev->lsb.current[desc->channel]) / 1000;
+#if IS_USED(MODULE_STPM3X_POWER)
+        case STPM3X_UNIT_POWER:
+            return ((int64_t)value * dev->lsb.power[desc->channel]) / 1000;
+#endif
+#if IS_USED(MODULE_STPM3X_ENERGY)
+        // LSB values in pico-units
+        case STPM3X_UNIT_ENERGY:
+            return ((int64_t)value * dev->lsb.energy[desc->channel]) / 1000000;
+        case STPM3X_UNIT_CHARGE:
+            return ((int64_t)value * dev->lsb.charge[desc->channel]) / 1000000;
+#endif
+        default:
+            return value;
+    }
+}
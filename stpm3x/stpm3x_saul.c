@@ -18,69 +18,116 @@
  * @}
  */
 
+#include <errno.h>
+#include <stdint.h>
+
 #include "saul.h"
 #include "stpm3x.h"
 
-static int read_current_rms_1(const void *dev, phydat_t *res)
+/*
+ * Fill a SAUL reading, choosing the smallest scale making all values fit in int16_t
+ */
+static int _fit(phydat_t *res, const int64_t *values, unsigned dim)
 {
-    const stpm3x_t *d = (stpm3x_t *) dev;
+    int64_t max = 0;
+
+    for (unsigned i = 0; i < dim; i++)
+    {
+        int64_t abs = (values[i] < 0) ? -values[i] : values[i];
+        max = (abs > max) ? abs : max;
+    }
+
+    int64_t div = 1;
+    res->scale = 0;
 
-    res->val[0] = stpm3x_read_current_rms_1(d);
-    res->unit = UNIT_A;
-    res->scale = -3;
-    return 1;
+    while ((max / div) > PHYDAT_MAX && res->scale < 9)
+    {
+        div *= 10;
+        res->scale++;
+    }
+
+    for (unsigned i = 0; i < dim; i++)
+    {
+        int64_t value = values[i] / div;
+        // saturate instead of wrapping if the values still do not fit
+        res->val[i] = (value > PHYDAT_MAX) ? PHYDAT_MAX : ((value < PHYDAT_MIN) ? PHYDAT_MIN : value);
+    }
+
+    res->unit = UNIT_NONE;
+    return dim;
 }
 
-static int read_voltage_rms_1(const void *dev, phydat_t *res)
+static int _read_phase(stpm3x_t *dev, phydat_t *res, unsigned channel)
 {
-    const stpm3x_t *d = (stpm3x_t *) dev;
+    stpm3x_snapshot_t snap;
+    stpm3x_measure_t measure;
+
+    if (stpm3x_read_snapshot_recent(dev, &snap, STPM3X_SAUL_MAX_AGE_US) != STPM3X_OK)
+    {
+        return -ECANCELED;
+    }
+    stpm3x_snapshot_to_measure(dev, &snap, &measure);
+
+    const int64_t values[3] = {
+        measure.voltage[channel] / 10000,     // [10 mV]
+        measure.current[channel] / 1000,      // [mA]
+        measure.power[channel] / 1000,        // [W]
+    };
 
-    res->val[0] = stpm3x_read_voltage_rms_1(d);
-    res->unit = UNIT_V;
-    res->scale = -3;
-    return 1;
+    return _fit(res, values, 3);
 }
 
-static int read_current_rms_2(const void *dev, phydat_t *res)
+static int read_phase_1(const void *dev, phydat_t *res)
 {
-    const stpm3x_t *d = (stpm3x_t *) dev;
+    return _read_phase((stpm3x_t *) dev, res, 0);
+}
 
-    res->val[0] = stpm3x_read_current_rms_2(d);
-    res->unit = UNIT_A;
-    res->scale = -3;
-    return 1;
+#if IS_USED(MODULE_STPM3X_CH2)
+static int read_phase_2(const void *dev, phydat_t *res)
+{
+    return _read_phase((stpm3x_t *) dev, res, 1);
 }
+#endif
 
-static int read_voltage_rms_2(const void *dev, phydat_t *res)
+static int read_line(const void *dev, phydat_t *res)
 {
-    const stpm3x_t *d = (stpm3x_t *) dev;
+    stpm3x_t *d = (stpm3x_t *) dev;
+    stpm3x_snapshot_t snap;
+    stpm3x_measure_t measure;
+    stpm3x_line_t line;
 
-    res->val[0] = stpm3x_read_voltage_rms_2(d);
-    res->unit = UNIT_V;
-    res->scale = -3;
-    return 1;
-}
+    if (stpm3x_read_snapshot_recent(d, &snap, STPM3X_SAUL_MAX_AGE_US) != STPM3X_OK)
+    {
+        return -ECANCELED;
+    }
+    stpm3x_snapshot_to_measure(d, &snap, &measure);
+    stpm3x_snapshot_to_line(&snap, &line);
 
-const saul_driver_t stpm3x_current1_saul_driver = {
-    .read = read_current_rms_1,
-    .write = saul_notsup,
-    .type = SAUL_SENSE_ANALOG
-};
+    const int64_t values[3] = {
+        measure.period[0],              // [us]
+        line.frequency[0] / 10,         // [10 mHz]
+        line.pf[0],                     // [1/1000]
+    };
+
+    return _fit(res, values, 3);
+}
 
-const saul_driver_t stpm3x_voltage1_saul_driver = {
-    .read = read_voltage_rms_1,
+const saul_driver_t stpm3x_phase1_saul_driver = {
+    .read = read_phase_1,
     .write = saul_notsup,
     .type = SAUL_SENSE_ANALOG
 };
 
-const saul_driver_t stpm3x_current2_saul_driver = {
-    .read = read_current_rms_2,
+#if IS_USED(MODULE_STPM3X_CH2)
+const saul_driver_t stpm3x_phase2_saul_driver = {
+    .read = read_phase_2,
     .write = saul_notsup,
     .type = SAUL_SENSE_ANALOG
 };
+#endif
 
-const saul_driver_t stpm3x_voltage2_saul_driver = {
-    .read = read_voltage_rms_2,
+const saul_driver_t stpm3x_line_saul_driver = {
+    .read = read_line,
     .write = saul_notsup,
     .type = SAUL_SENSE_ANALOG
 };
@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2020 eeproperty Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     drivers_stpm3x
+ * @{
+ *
+ * @file
+ * @brief       SenML CBOR export of STPM3x snapshots
+ *              Records are written straight into the caller buffer by a minimal CBOR writer.
+ *
+ * @author      Joël Carron <jo.carron@cartondu.ch>
+ *
+ * @}
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "assert.h"
+#include "kernel_defines.h"
+
+#include "stpm3x.h"
+
+/**
+ * @name SenML CBOR labels (RFC 8428, table 6)
+ * @{
+ */
+#define SENML_LABEL_BASE_NAME           (-2)
+#define SENML_LABEL_NAME                (0)
+#define SENML_LABEL_UNIT                (1)
+#define SENML_LABEL_VALUE               (2)
+/** @} */
+
+/**
+ * @name CBOR major types
+ * @{
+ */
+#define CBOR_UINT                       (0x00)
+#define CBOR_NINT                       (0x20)
+#define CBOR_TEXT                       (0x60)
+#define CBOR_ARRAY                      (0x80)
+#define CBOR_MAP                        (0xA0)
+#define CBOR_FLOAT32                    (0xFA)
+/** @} */
+
+/**
+ * @brief Exported quantity of one channel
+ */
+typedef struct {
+    const char *name;               /**< SenML name */
+    const char *unit;               /**< SenML unit */
+} _field_t;
+
+static const _field_t _fields[] = {
+    { "voltage",   "V"  },
+    { "current",   "A"  },
+    { "power",     "W"  },
+    { "frequency", "Hz" },
+};
+
+/**
+ * @brief Output buffer, writes past its end are counted but dropped
+ */
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+    size_t pos;
+} _cbor_t;
+
+static void _put(_cbor_t *out, const void *data, size_t size)
+{
+    if (size && ((out->pos + size) <= out->len))
+    {
+        memcpy(out->buf + out->pos, data, size);
+    }
+    out->pos += size;
+}
+
+static void _head(_cbor_t *out, uint8_t major, uint32_t arg)
+{
+    uint8_t head[5];
+    size_t size;
+
+    if (arg < 24)
+    {
+        head[0] = major | arg;
+        size = 1;
+    }
+    else if (arg <= UINT8_MAX)
+    {
+        head[0] = major | 24;
+        head[1] = arg;
+        size = 2;
+    }
+    else if (arg <= UINT16_MAX)
+    {
+        head[0] = major | 25;
+        head[1] = arg >> 8;
+        head[2] = arg;
+        size = 3;
+    }
+    else
+    {
+        head[0] = major | 26;
+        head[1] = arg >> 24;
+        head[2] = arg >> 16;
+        head[3] = arg >> 8;
+        head[4] = arg;
+        size = 5;
+    }
+
+    _put(out, head, size);
+}
+
+static void _label(_cbor_t *out, int label)
+{
+    if (label < 0)
+    {
+        _head(out, CBOR_NINT, -1 - label);
+    }
+    else
+    {
+        _head(out, CBOR_UINT, label);
+    }
+}
+
+static void _text(_cbor_t *out, const char *text)
+{
+    size_t size = strlen(text);
+
+    _head(out, CBOR_TEXT, size);
+    _put(out, text, size);
+}
+
+static void _float(_cbor_t *out, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint8_t data[5] = { CBOR_FLOAT32, bits >> 24, bits >> 16, bits >> 8, bits };
+    _put(out, data, sizeof(data));
+}
+
+int stpm3x_snapshot_to_senml_cbor(const stpm3x_t *dev, const stpm3x_snapshot_t *snap, const char *name,
+                                  uint8_t *buf, size_t len)
+{
+    assert(dev && snap && buf);
+
+    stpm3x_measure_t measure;
+    stpm3x_snapshot_to_measure(dev, snap, &measure);
+
+    size_t name_len = (name) ? strlen(name) : 0;
+    _cbor_t out = { .buf = buf, .len = len, .pos = 0 };
+
+    _head(&out, CBOR_ARRAY, STPM3X_SENML_RECORDS);
+
+    for (unsigned i = 0; i < 2; i++)
+    {
+        float values[] = {
+            measure.voltage[i] / 1e6f,
+            measure.current[i] / 1e6f,
+            measure.power[i] / 1e3f,
+            (measure.period[i]) ? 1e6f / measure.period[i] : 0.0f,
+        };
+
+        for (unsigned f = 0; f < ARRAY_SIZE(_fields); f++)
+        {
+            _head(&out, CBOR_MAP, (f == 0) ? 4 : 3);
+
+            if (f == 0)
+            {
+                // base name written in place: <name>ph1:
+                char suffix[] = "ph1:";
+                suffix[2] += i;
+
+                _label(&out, SENML_LABEL_BASE_NAME);
+                _head(&out, CBOR_TEXT, name_len + sizeof(suffix) - 1);
+                _put(&out, name, name_len);
+                _put(&out, suffix, sizeof(suffix) - 1);
+            }
+
+            _label(&out, SENML_LABEL_NAME);
+            _text(&out, _fields[f].name);
+            _label(&out, SENML_LABEL_UNIT);
+            _text(&out, _fields[f].unit);
+            _label(&out, SENML_LABEL_VALUE);
+            _float(&out, values[f]);
+        }
+    }
+
+    return (out.pos <= len) ? (int)out.pos : STPM3X_ERROR;
+}
@@ -0,0 +1,350 @@
+/*
+ * Copyright (C) 2020 eeproperty Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     drivers_stpm3x
+ * @{
+ *
+ * @file
+ * @brief       Shell command of the STPM3x driver
+ *              Register dump, link statistics and on-target read benchmark.
+ *
+ * @author      Joël Carron <jo.carron@cartondu.ch>
+ *
+ * @}
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernel_defines.h"
+
+#include "stpm3x.h"
+#include "stpm3x_internals.h"
+#include "stpm3x_time.h"
+
+/**
+ * @brief Number of registers, from DSP_CR1 to TOT_REG4
+ */
+#define REG_NUMOF       ((STPM3X_REG_TOT_APPARENT_ENERGY / 2) + 1)
+
+/**
+ * @brief Registers read by the burst mode: one transfer of STPM3X_BURST_FRAMES frames
+ */
+#define BURST_NUMOF     (STPM3X_BURST_FRAMES - 1)
+
+/**
+ * @brief Access modes measured by `stpm3x bench`
+ */
+enum {
+    _BENCH_SINGLE = 0,              /**< one register */
+    _BENCH_BURST,                   /**< BURST_NUMOF registers in one transfer */
+    _BENCH_SNAPSHOT,                /**< latch + snapshot registers */
+    _BENCH_WAVE,                    /**< latch + instantaneous data registers, back to back */
+    _BENCH_NUMOF
+};
+
+static const char *_bench_names[_BENCH_NUMOF] = {
+    [_BENCH_SINGLE]   = "single",
+    [_BENCH_BURST]    = "burst",
+    [_BENCH_SNAPSHOT] = "snapshot",
+    [_BENCH_WAVE]     = "wave",
+};
+
+static const uint8_t _wave_regs[] = {
+    STPM3X_REG_DSP_REG2, STPM3X_REG_DSP_REG3, STPM3X_REG_DSP_REG4, STPM3X_REG_DSP_REG5
+};
+
+static stpm3x_t *_devs;
+static size_t _numof;
+
+void stpm3x_shell_init(stpm3x_t *devs, size_t numof)
+{
+    _devs = devs;
+    _numof = numof;
+}
+
+static int _usage(const char *cmd)
+{
+    printf("usage: %s dump <dev> [<addr> [<count>]]\n", cmd);
+    printf("       %s stats\n", cmd);
+    printf("       %s bench <dev> [<ms>]\n", cmd);
+#if IS_USED(MODULE_STPM3X_TRACE)
+    printf("       %s trace <dev>\n", cmd);
+#endif
+
+    return 1;
+}
+
+static stpm3x_t *_get_dev(const char *arg)
+{
+    unsigned long idx = strtoul(arg, NULL, 0);
+
+    if (idx >= _numof)
+    {
+        printf("stpm3x: no device #%lu, %u registered\n", idx, (unsigned)_numof);
+        return NULL;
+    }
+
+    return &_devs[idx];
+}
+
+static void _print_bus(const stpm3x_t *dev)
+{
+#ifdef MODULE_PERIPH_UART
+    if (dev->transport == &stpm3x_transport_uart)
+    {
+        printf("uart at %lu bauds", (unsigned long)dev->uart.baudrate);
+        return;
+    }
+#endif
+    if (dev->transport != &stpm3x_transport_spi)
+    {
+        printf("custom transport");
+    }
+    else if (dev->link.clk == UINT8_MAX)
+    {
+        printf("spi, fixed clock");
+    }
+    else
+    {
+        printf("spi, clock step %u", dev->link.clk);
+    }
+}
+
+static int _cmd_dump(int argc, char **argv)
+{
+    stpm3x_t *dev = _get_dev(argv[2]);
+
+    if (dev == NULL)
+    {
+        return 1;
+    }
+
+    unsigned first = (argc > 3) ? strtoul(argv[3], NULL, 0) / 2 : 0;
+    unsigned count = (argc > 4) ? strtoul(argv[4], NULL, 0) : REG_NUMOF;
+
+    first = (first > REG_NUMOF) ? REG_NUMOF : first;
+    count = (count > (REG_NUMOF - first)) ? REG_NUMOF - first : count;
+
+    uint8_t regs[STPM3X_SHELL_DUMP_CHUNK];
+    uint32_t values[STPM3X_SHELL_DUMP_CHUNK];
+
+    for (unsigned done = 0; done < count;)
+    {
+        unsigned num = ((count - done) < STPM3X_SHELL_DUMP_CHUNK) ? count - done : STPM3X_SHELL_DUMP_CHUNK;
+
+        for (unsigned i = 0; i < num; i++)
+        {
+            regs[i] = (first + done + i) * 2;
+        }
+
+        // each chunk is latched once: the values of a chunk are coherent
+        if (stpm3x_read_latched(dev, regs, values, num) != STPM3X_OK)
+        {
+            puts("stpm3x: CRC errors, the values below may be wrong");
+        }
+
+        for (unsigned i = 0; i < num; i++)
+        {
+            printf("0x%02x: 0x%08lx\n", regs[i], (unsigned long)values[i]);
+        }
+
+        done += num;
+    }
+
+    return 0;
+}
+
+static int _cmd_stats(void)
+{
+    for (unsigned i = 0; i < _numof; i++)
+    {
+        stpm3x_t *dev = &_devs[i];
+        const stpm3x_link_t *link = &dev->link;
+        stpm3x_jitter_stats_t jitter;
+
+        printf("#%u: ", i);
+        _print_bus(dev);
+        printf(", %lu frames, %lu CRC errors (window: %u frames, %u errors)\n",
+               (unsigned long)link->total_frames, (unsigned long)link->total_errors, link->frames, link->errors);
+
+        printf("    %lu snapshots, gain", (unsigned long)dev->snap_gen);
+        for (unsigned ch = 0; ch < STPM3X_CHANNELS; ch++)
+        {
+            printf(" %u", dev->gain[ch]);
+        }
+        printf(", ranging 0x%x\n", dev->ranging);
+
+        stpm3x_read_jitter(dev, &jitter, false);
+        printf("    interval %lu us, jitter %lu us (min %lu, max %lu over %lu)\n",
+               (unsigned long)jitter.mean, (unsigned long)jitter.stddev, (unsigned long)jitter.min,
+               (unsigned long)jitter.max, (unsigned long)jitter.count);
+    }
+
+    return 0;
+}
+
+static uint8_t _bench_op(stpm3x_t *dev, unsigned mode, const uint8_t *burst_regs)
+{
+    uint32_t values[BURST_NUMOF];
+    stpm3x_snapshot_t snap;
+
+    switch (mode)
+    {
+        case _BENCH_SINGLE:
+            return stpm3x_read_reg(dev, STPM3X_REG_DSP_REG14, values);
+        case _BENCH_BURST:
+            return stpm3x_read_regs(dev, burst_regs, values, BURST_NUMOF);
+        case _BENCH_SNAPSHOT:
+            return stpm3x_read_snapshot(dev, &snap);
+        default:
+            return stpm3x_read_latched(dev, _wave_regs, values, ARRAY_SIZE(_wave_regs));
+    }
+}
+
+static int _cmd_bench(int argc, char **argv)
+{
+    stpm3x_t *dev = _get_dev(argv[2]);
+
+    if (dev == NULL)
+    {
+        return 1;
+    }
+
+    const uint32_t duration = ((argc > 3) ? strtoul(argv[3], NULL, 0) : STPM3X_SHELL_BENCH_MS) * 1000;
+    uint8_t burst_regs[BURST_NUMOF];
+
+    for (unsigned i = 0; i < BURST_NUMOF; i++)
+    {
+        burst_regs[i] = (STPM3X_REG_DSP_REG1 + (2 * i)) % (REG_NUMOF * 2);
+    }
+
+    printf("#%s: ", argv[2]);
+    _print_bus(dev);
+    puts("");
+    puts("mode       reads/s  frames/s  avg [us]  min [us]  max [us]  errors");
+
+    for (unsigned mode = 0; mode < _BENCH_NUMOF; mode++)
+    {
+        uint32_t ops = 0;
+        uint32_t errors = 0;
+        uint64_t total = 0;
+        uint32_t min = UINT32_MAX;
+        uint32_t max = 0;
+        uint32_t frames = dev->link.total_frames;
+        uint32_t start = stpm3x_time_now();
+        uint32_t elapsed;
+
+        do
+        {
+            uint32_t t0 = stpm3x_time_now();
+
+            if (_bench_op(dev, mode, burst_regs) != STPM3X_OK)
+            {
+                errors++;
+            }
+
+            uint32_t latency = stpm3x_time_now() - t0;
+
+            total += latency;
+            min = (latency < min) ? latency : min;
+            max = (latency > max) ? latency : max;
+            ops++;
+
+            elapsed = stpm3x_time_now() - start;
+        } while (elapsed < duration);
+
+        frames = dev->link.total_frames - frames;
+        elapsed = (elapsed) ? elapsed : 1;
+
+        printf("%-9s %8lu  %8lu  %8lu  %8lu  %8lu  %6lu\n", _bench_names[mode],
+               (unsigned long)(((uint64_t)ops * 1000000) / elapsed),
+               (unsigned long)(((uint64_t)frames * 1000000) / elapsed),
+               (unsigned long)(total / ops), (unsigned long)min, (unsigned long)max, (unsigned long)errors);
+    }
+
+    return 0;
+}
+
+#if IS_USED(MODULE_STPM3X_TRACE)
+static void _print_hex(const void *data, size_t len)
+{
+    const uint8_t *bytes = data;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        printf("%02x", bytes[i]);
+    }
+    puts("");
+}
+
+static int _cmd_trace(char **argv)
+{
+    stpm3x_t *dev = _get_dev(argv[2]);
+
+    if (dev == NULL)
+    {
+        return 1;
+    }
+    if (dev->params.trace == NULL)
+    {
+        printf("stpm3x: device #%s has no trace\n", argv[2]);
+        return 1;
+    }
+
+    // one line for the header then one per record, `xxd -r -p` gives the binary export back
+    stpm3x_trace_hdr_t hdr;
+    stpm3x_trace_rec_t rec;
+
+    stpm3x_trace_header(dev->params.trace, &hdr);
+    _print_hex(&hdr, sizeof(hdr));
+
+    for (size_t i = 0; (i < hdr.count) && (stpm3x_trace_get(dev->params.trace, i, &rec) == STPM3X_OK); i++)
+    {
+        _print_hex(&rec, sizeof(rec));
+    }
+
+    return 0;
+}
+#endif
+
+int stpm3x_shell_cmd(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        return _usage(argv[0]);
+    }
+
+    if (strcmp(argv[1], "stats") == 0)
+    {
+        return _cmd_stats();
+    }
+    if (argc < 3)
+    {
+        return _usage(argv[0]);
+    }
+    if (strcmp(argv[1], "dump") == 0)
+    {
+        return _cmd_dump(argc, argv);
+    }
+    if (strcmp(argv[1], "bench") == 0)
+    {
+        return _cmd_bench(argc, argv);
+    }
+#if IS_USED(MODULE_STPM3X_TRACE)
+    if (strcmp(argv[1], "trace") == 0)
+    {
+        return _cmd_trace(argv);
+    }
+#endif
+
+    return _usage(argv[0]);
+}
@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2020 eeproperty Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     drivers_stpm3x
+ * @{
+ *
+ * @file
+ * @brief       Timebase and sample timing statistics of the STPM3x driver
+ *
+ * @author      Joël Carron <jo.carron@cartondu.ch>
+ *
+ * @}
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "assert.h"
+#include "irq.h"
+#include "mutex.h"
+
+#include "stpm3x.h"
+#include "stpm3x_math.h"
+#include "stpm3x_time.h"
+
+#if IS_USED(MODULE_ZTIMER_USEC)
+/**
+ * @brief Longest sleep of stpm3x_time_sleep64(), half the range of the clock
+ */
+#define SLEEP_CHUNK_US          (UINT32_MAX / 2)
+
+/**
+ * @brief Period of the timer keeping the 64 bits time in step, half the range of the clock
+ */
+#define KEEPER_PERIOD_US        (UINT32_MAX / 2)
+
+/**
+ * @brief Waiter of stpm3x_time_lock_timeout()
+ */
+typedef struct {
+    mutex_t *mutex;                 /**< mutex waited for */
+    volatile bool timeout;          /**< set by the timer */
+} _lock_timeout_t;
+
+static void _lock_timeout_cb(void *arg)
+{
+    _lock_timeout_t *waiter = arg;
+
+    waiter->timeout = true;
+    mutex_unlock(waiter->mutex);
+}
+
+static ztimer_t _keeper;
+
+/*
+ * Reads the time at least twice per wrap of the clock, so that no wrap is missed
+ */
+static void _keeper_cb(void *arg)
+{
+    (void)arg;
+
+    stpm3x_time_now64();
+    ztimer_set(ZTIMER_USEC, &_keeper, KEEPER_PERIOD_US);
+}
+#endif
+
+uint64_t stpm3x_time_now64(void)
+{
+#if IS_USED(MODULE_ZTIMER_USEC)
+    static uint32_t high;
+    static uint32_t last;
+
+    unsigned state = irq_disable();
+    uint32_t now = ztimer_now(ZTIMER_USEC);
+
+    // the keeper is armed by the first call, then re-arms itself
+    if (_keeper.callback == NULL)
+    {
+        _keeper.callback = _keeper_cb;
+        ztimer_set(ZTIMER_USEC, &_keeper, KEEPER_PERIOD_US);
+    }
+
+    // the clock wrapped since the previous call
+    if (now < last)
+    {
+        high++;
+    }
+    last = now;
+
+    uint64_t res = ((uint64_t)high << 32) | now;
+    irq_restore(state);
+
+    return res;
+#else
+    return xtimer_now_usec64();
+#endif
+}
+
+void stpm3x_time_sleep64(uint64_t us)
+{
+#if IS_USED(MODULE_ZTIMER_USEC)
+    while (us)
+    {
+        uint32_t chunk = (us > SLEEP_CHUNK_US) ? SLEEP_CHUNK_US : (uint32_t)us;
+
+        ztimer_sleep(ZTIMER_USEC, chunk);
+        us -= chunk;
+    }
+#else
+    xtimer_usleep64(us);
+#endif
+}
+
+int stpm3x_time_lock_timeout(mutex_t *mutex, uint32_t timeout)
+{
+#if IS_USED(MODULE_ZTIMER_USEC)
+    _lock_timeout_t waiter = { .mutex = mutex, .timeout = false };
+    ztimer_t timer = { .callback = _lock_timeout_cb, .arg = &waiter };
+
+    if (mutex_trylock(mutex))
+    {
+        return 0;
+    }
+
+    ztimer_set(ZTIMER_USEC, &timer, timeout);
+    mutex_lock(mutex);
+    ztimer_remove(ZTIMER_USEC, &timer);
+
+    return (waiter.timeout) ? -1 : 0;
+#else
+    return xtimer_mutex_lock_timeout(mutex, timeout);
+#endif
+}
+
+void stpm3x_jitter_reset(stpm3x_jitter_t *jitter)
+{
+    assert(jitter);
+
+    memset(jitter, 0, sizeof(*jitter));
+}
+
+void stpm3x_jitter_add(stpm3x_jitter_t *jitter, uint32_t time)
+{
+    uint32_t interval = time - jitter->last;
+
+    jitter->last = time;
+
+    if (jitter->samples++ == 0)
+    {
+        return;
+    }
+
+    if (jitter->samples == 2)
+    {
+        jitter->first = interval;
+        jitter->min = interval;
+        jitter->max = interval;
+    }
+
+    int64_t dev = (int64_t)interval - jitter->first;
+    // |dev| < 2^32: its square fits in 64 bits unsigned, the sum saturates
+    uint64_t abs_dev = (dev < 0) ? -dev : dev;
+    uint64_t square = abs_dev * abs_dev;
+
+    jitter->min = (interval < jitter->min) ? interval : jitter->min;
+    jitter->max = (interval > jitter->max) ? interval : jitter->max;
+    jitter->sum += dev;
+    jitter->sum_sq = (jitter->sum_sq > (UINT64_MAX - square)) ? UINT64_MAX : jitter->sum_sq + square;
+}
+
+void stpm3x_jitter_stats(const stpm3x_jitter_t *jitter, stpm3x_jitter_stats_t *stats)
+{
+    assert(jitter && stats);
+
+    memset(stats, 0, sizeof(*stats));
+
+    if (jitter->samples < 2)
+    {
+        return;
+    }
+
+    const uint32_t count = jitter->samples - 1;
+    const int64_t mean = jitter->sum / count;
+    const uint64_t abs_mean = (mean < 0) ? -mean : mean;
+    const uint64_t mean_sq = jitter->sum_sq / count;
+    // the integer divisions may leave the variance slightly negative
+    const uint64_t var = (mean_sq > (abs_mean * abs_mean)) ? mean_sq - (abs_mean * abs_mean) : 0;
+
+    stats->count = count;
+    stats->mean = jitter->first + mean;
+    stats->min = jitter->min;
+    stats->max = jitter->max;
+    stats->stddev = stpm3x_isqrt(var);
+}
+
+void stpm3x_read_jitter(stpm3x_t *dev, stpm3x_jitter_stats_t *stats, bool reset)
+{
+    assert(dev && stats);
+
+    mutex_lock(&dev->lock);
+
+    stpm3x_jitter_stats(&dev->jitter, stats);
+
+    if (reset)
+    {
+        stpm3x_jitter_reset(&dev->jitter);
+    }
+
+    mutex_unlock(&dev->lock);
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2020 eeproperty Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     drivers_stpm3x
+ * @{
+ *
+ * @file
+ * @brief       Frame trace of the STPM3x driver
+ *              Every frame exchanged is kept in a RAM ring, exported for replay.
+ *
+ * @author      Joël Carron <jo.carron@cartondu.ch>
+ *
+ * @}
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "assert.h"
+#include "mutex.h"
+
+#include "stpm3x.h"
+#include "stpm3x_internals.h"
+
+#define ENABLE_DEBUG    (DEBUG_MODE)
+#include "debug.h"
+
+/*
+ * Record of the given age, called with trace->lock held
+ */
+static stpm3x_trace_rec_t *_rec(stpm3x_trace_t *trace, size_t index)
+{
+    return &trace->buf[(trace->head + trace->size - trace->count + index) % trace->size];
+}
+
+void stpm3x_trace_init(stpm3x_trace_t *trace, stpm3x_trace_rec_t *buf, size_t size)
+{
+    assert(trace && buf && size);
+
+    memset(trace, 0, sizeof(*trace));
+    mutex_init(&trace->lock);
+    trace->buf = buf;
+    trace->size = size;
+}
+
+int stpm3x_trace_load(stpm3x_trace_t *trace, const void *data, size_t len)
+{
+    assert(trace && data);
+
+    stpm3x_trace_hdr_t hdr;
+
+    if (len < sizeof(hdr))
+    {
+        return STPM3X_ERROR;
+    }
+
+    memcpy(&hdr, data, sizeof(hdr));
+
+    if ((hdr.magic != STPM3X_TRACE_MAGIC) || (hdr.version != STPM3X_TRACE_VERSION) ||
+        (hdr.rec_size != sizeof(stpm3x_trace_rec_t)) || (hdr.count == 0) ||
+        (hdr.count > ((len - sizeof(hdr)) / sizeof(stpm3x_trace_rec_t))))
+    {
+        DEBUG("%s : not a trace of version %u\n", DEBUG_FUNC, STPM3X_TRACE_VERSION);
+        return STPM3X_ERROR;
+    }
+
+    // the replay only reads the records
+    stpm3x_trace_init(trace, (stpm3x_trace_rec_t *)((uintptr_t)data + sizeof(hdr)), hdr.count);
+    trace->count = hdr.count;
+    trace->lost = hdr.lost;
+
+    return STPM3X_OK;
+}
+
+void stpm3x_trace_record(stpm3x_trace_t *trace, uint8_t id, uint32_t time, const uint8_t *out, const uint8_t *in,
+                         size_t frames, bool lost, uint8_t (*crc)(const uint8_t *frame))
+{
+    mutex_lock(&trace->lock);
+
+    for (size_t f = 0; f < frames; f++)
+    {
+        stpm3x_trace_rec_t *rec = &trace->buf[trace->head];
+        const uint8_t *answer = &in[f * STPM3X_FRAME_LEN];
+
+        rec->time = time;
+        memcpy(rec->out, &out[f * STPM3X_FRAME_LEN], STPM3X_FRAME_LEN);
+        memcpy(rec->in, answer, STPM3X_FRAME_LEN);
+        rec->flags = (f == 0) ? STPM3X_TRACE_START : 0;
+        rec->flags |= (lost) ? STPM3X_TRACE_LOST : 0;
+        rec->flags |= (!lost && (crc(answer) != answer[4])) ? STPM3X_TRACE_BAD_CRC : 0;
+        rec->id = id;
+
+        trace->head = (trace->head + 1) % trace->size;
+
+        if (trace->count < trace->size)
+        {
+            trace->count++;
+        }
+        else
+        {
+            trace->lost++;
+        }
+    }
+
+    mutex_unlock(&trace->lock);
+}
+
+void stpm3x_trace_header(stpm3x_trace_t *trace, stpm3x_trace_hdr_t *hdr)
+{
+    assert(trace && hdr);
+
+    mutex_lock(&trace->lock);
+
+    hdr->magic = STPM3X_TRACE_MAGIC;
+    hdr->version = STPM3X_TRACE_VERSION;
+    hdr->rec_size = sizeof(stpm3x_trace_rec_t);
+    hdr->count = trace->count;
+    hdr->lost = trace->lost;
+
+    mutex_unlock(&trace->lock);
+}
+
+int stpm3x_trace_get(stpm3x_trace_t *trace, size_t index, stpm3x_trace_rec_t *rec)
+{
+    assert(trace && rec);
+
+    int res = STPM3X_ERROR;
+
+    mutex_lock(&trace->lock);
+
+    if (index < trace->count)
+    {
+        *rec = *_rec(trace, index);
+        res = STPM3X_OK;
+    }
+
+    mutex_unlock(&trace->lock);
+
+    return res;
+}
+
+#ifdef MODULE_MTD
+int stpm3x_trace_write(stpm3x_trace_t *trace, mtd_dev_t *mtd, uint32_t addr, uint32_t size)
+{
+    assert(trace && mtd);
+
+    const uint32_t sector = mtd->pages_per_sector * mtd->page_size;
+    const size_t room = (size > sizeof(stpm3x_trace_hdr_t)) ?
+                        (size - sizeof(stpm3x_trace_hdr_t)) / sizeof(stpm3x_trace_rec_t) : 0;
+    stpm3x_trace_hdr_t hdr;
+    int res = STPM3X_ERROR;
+
+    mutex_lock(&trace->lock);
+
+    // the oldest records are left out when the area is too small
+    size_t skip = (trace->count > room) ? trace->count - room : 0;
+
+    hdr.magic = STPM3X_TRACE_MAGIC;
+    hdr.version = STPM3X_TRACE_VERSION;
+    hdr.rec_size = sizeof(stpm3x_trace_rec_t);
+    hdr.count = trace->count - skip;
+    hdr.lost = trace->lost + skip;
+
+    uint32_t len = sizeof(hdr) + (hdr.count * sizeof(stpm3x_trace_rec_t));
+
+    // the records are in at most two contiguous parts of the ring
+    size_t first = (trace->head + trace->size - trace->count + skip) % trace->size;
+    size_t num = trace->size - first;
+    num = (hdr.count < num) ? hdr.count : num;
+    uint32_t second = addr + sizeof(hdr) + (num * sizeof(stpm3x_trace_rec_t));
+
+    if (mtd_erase(mtd, addr, ((len + sector - 1) / sector) * sector) < 0)
+    {
+        DEBUG("%s : could not erase the trace area at 0x%lx\n", DEBUG_FUNC, (unsigned long)addr);
+    }
+    else if ((stpm3x_mtd_write(mtd, addr, &hdr, sizeof(hdr)) == STPM3X_OK) &&
+             (stpm3x_mtd_write(mtd, addr + sizeof(hdr), &trace->buf[first],
+                               num * sizeof(stpm3x_trace_rec_t)) == STPM3X_OK) &&
+             (stpm3x_mtd_write(mtd, second, trace->buf,
+                               (hdr.count - num) * sizeof(stpm3x_trace_rec_t)) == STPM3X_OK))
+    {
+        res = len;
+    }
+
+    mutex_unlock(&trace->lock);
+
+    return res;
+}
+#endif
@@ -0,0 +1,424 @@
+/*
+ * Copyright (C) 2020 eeproperty Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     drivers_stpm3x
+ * @{
+ *
+ * @file
+ * @brief       SPI, UART and trace replay transports of the STPM3x driver
+ *              Both buses carry the same 5 bytes frames, only the CRC differs.
+ *
+ * @author      Joël Carron <jo.carron@cartondu.ch>
+ *
+ * @}
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "assert.h"
+#include "kernel_defines.h"
+#include "mutex.h"
+#include "periph/spi.h"
+#include "periph/gpio.h"
+
+#include "stpm3x.h"
+#include "stpm3x_internals.h"
+#include "stpm3x_params.h"
+#include "stpm3x_time.h"
+
+#define ENABLE_DEBUG    (DEBUG_MODE)
+#include "debug.h"
+
+/*
+ * Two functions taken from user manuel from ST "UM2066"- "Getting started with the STPM3x"
+ */
+static void _crc8_calc(uint8_t data, uint8_t *crc_checksum)
+{
+    uint8_t tmp;
+
+    for (uint8_t i = 0; i < 8; i++)
+    {
+        tmp = data ^ *crc_checksum;
+        *crc_checksum <<= 1;
+
+        if (tmp & 0x80)
+        {
+            *crc_checksum ^= STPM3X_CRC_8;
+        }
+
+        data <<= 1;
+    }
+}
+
+static uint8_t _spi_calc_crc8(const uint8_t *buf)
+{
+    uint8_t crc_checksum = 0x00;
+
+    for (uint8_t i = 0; i < STPM3X_FRAME_LEN - 1; i++)
+    {
+        _crc8_calc(buf[i], &crc_checksum);
+    }
+
+    return crc_checksum;
+}
+
+static int _spi_init(stpm3x_t *dev)
+{
+    if (spi_init_cs(dev->params.spi, dev->params.scs) != SPI_OK)
+    {
+        DEBUG("%s : error while initializing CS pin\n", DEBUG_FUNC);
+        return STPM3X_ERROR;
+    }
+
+    return STPM3X_OK;
+}
+
+static void _spi_acquire(stpm3x_t *dev)
+{
+    spi_acquire(dev->params.spi, dev->params.scs, STPM3X_SPI_MODE, dev->params.sclk);
+}
+
+static int _spi_transfer(stpm3x_t *dev, const uint8_t *out, uint8_t *in, size_t frames)
+{
+    spi_transfer_bytes(dev->params.spi, dev->params.scs, true, out, in, frames * STPM3X_FRAME_LEN);
+
+    return STPM3X_OK;
+}
+
+static void _spi_release(stpm3x_t *dev)
+{
+    spi_release(dev->params.spi);
+}
+
+const stpm3x_transport_t stpm3x_transport_spi = {
+    .init = _spi_init,
+    .negotiate = stpm3x_link_train,
+    .acquire = _spi_acquire,
+    .transfer = _spi_transfer,
+    .release = _spi_release,
+    .crc = _spi_calc_crc8,
+    .scs_level = 0,
+};
+
+#ifdef MODULE_PERIPH_UART
+/**
+ * @brief Baud rates tried by the negotiation, the first one is the reset value
+ */
+static const uint32_t _uart_bauds[] = {
+    STPM3X_UART_BAUD_RESET, 19200, 57600, 115200, 230400, 460800
+};
+
+static uint8_t _reverse(uint8_t byte)
+{
+    byte = ((byte & 0xF0) >> 4) | ((byte & 0x0F) << 4);
+    byte = ((byte & 0xCC) >> 2) | ((byte & 0x33) << 2);
+
+    return ((byte & 0xAA) >> 1) | ((byte & 0x55) << 1);
+}
+
+/*
+ * The UART sends the LSB first: the CRC is computed on the bytes bit-reversed, UM2066 p.15
+ */
+static uint8_t _uart_calc_crc8(const uint8_t *buf)
+{
+    uint8_t crc_checksum = 0x00;
+
+    for (uint8_t i = 0; i < STPM3X_FRAME_LEN - 1; i++)
+    {
+        _crc8_calc(_reverse(buf[i]), &crc_checksum);
+    }
+
+    return _reverse(crc_checksum);
+}
+
+static void _uart_rx_cb(void *arg, uint8_t data)
+{
+    stpm3x_uart_rx_t *rx = &((stpm3x_t *)arg)->uart;
+
+    // bytes arriving while no burst waits for them are dropped
+    if ((rx->buf != NULL) && (rx->len < rx->want))
+    {
+        rx->buf[rx->len++] = data;
+
+        if (rx->len == rx->want)
+        {
+            mutex_unlock(&rx->done);
+        }
+    }
+}
+
+static int _uart_set_baudrate(stpm3x_t *dev, uint32_t baudrate)
+{
+    if (uart_init(dev->params.uart, baudrate, _uart_rx_cb, dev) != UART_OK)
+    {
+        DEBUG("%s : could not set the UART at %lu bauds\n", DEBUG_FUNC, (unsigned long)baudrate);
+        return STPM3X_ERROR;
+    }
+
+    dev->uart.baudrate = baudrate;
+
+    return STPM3X_OK;
+}
+
+/*
+ * BAUD_RATE field of US_REG2 for a baud rate
+ */
+static uint16_t _uart_divider(uint32_t baudrate)
+{
+    return (STPM3X_UART_CLK + (baudrate / 2)) / baudrate;
+}
+
+static int _uart_init(stpm3x_t *dev)
+{
+    const mutex_t locked = MUTEX_INIT_LOCKED;
+
+    mutex_init(&dev->uart.bus);
+    dev->uart.done = locked;
+    dev->uart.buf = NULL;
+    dev->uart.len = 0;
+    dev->uart.want = 0;
+
+    // SCS only selects the interface when EN rises
+    gpio_init(dev->params.scs, GPIO_OUT);
+
+    return _uart_set_baudrate(dev, STPM3X_UART_BAUD_RESET);
+}
+
+static void _uart_acquire(stpm3x_t *dev)
+{
+    mutex_lock(&dev->uart.bus);
+}
+
+static int _uart_transfer(stpm3x_t *dev, const uint8_t *out, uint8_t *in, size_t frames)
+{
+    stpm3x_uart_rx_t *rx = &dev->uart;
+    uint16_t size = frames * STPM3X_FRAME_LEN;
+    // 10 bits per byte, the answers trail the frames by one frame at most
+    uint32_t timeout = ((20UL * 1000000UL * size) / rx->baudrate) + STPM3X_UART_TIMEOUT_US;
+
+    // the late answer of a burst which timed out may have left it unlocked
+    mutex_trylock(&rx->done);
+    rx->len = 0;
+    rx->want = size;
+    rx->buf = in;
+
+    // the frames are written back to back, the device answers each of them while receiving the next
+    uart_write(dev->params.uart, out, size);
+
+    int res = stpm3x_time_lock_timeout(&rx->done, timeout);
+    rx->buf = NULL;
+
+    if (res != 0)
+    {
+        DEBUG("%s : %u of %u bytes received\n", DEBUG_FUNC, (unsigned)rx->len, (unsigned)size);
+        return STPM3X_ERROR;
+    }
+
+    return STPM3X_OK;
+}
+
+static void _uart_release(stpm3x_t *dev)
+{
+    mutex_unlock(&dev->uart.bus);
+}
+
+/*
+ * Read configuration registers known from the shadow, without CRC errors
+ */
+static bool _uart_check(stpm3x_t *dev)
+{
+    static const uint8_t regs[] = {
+        STPM3X_REG_US_REG1, STPM3X_REG_DFE_CR1, STPM3X_REG_DFE_CR2
+    };
+    uint32_t values[ARRAY_SIZE(regs)];
+
+    for (unsigned n = 0; n < STPM3X_LINK_TRAIN_BURSTS; n++)
+    {
+        if (stpm3x_read_regs(dev, regs, values, ARRAY_SIZE(regs)) != STPM3X_OK)
+        {
+            return false;
+        }
+
+        for (unsigned i = 0; i < ARRAY_SIZE(regs); i++)
+        {
+            if (values[i] != dev->shadow[regs[i] / 2])
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Called by stpm3x_init(), while US_REG2 still holds its reset value
+ */
+static uint8_t _uart_negotiate(stpm3x_t *dev)
+{
+    const uint32_t initial = dev->shadow[STPM3X_REG_US_REG2 / 2];
+    const uint32_t max = (dev->params.baudrate) ? dev->params.baudrate : STPM3X_UART_BAUD_MAX;
+    const stpm3x_lp_t lp = STPM3X_LP_DEFAULT;
+    uint8_t res = STPM3X_ERROR;
+
+    for (int b = ARRAY_SIZE(_uart_bauds) - 1; (b > 0) && (res != STPM3X_OK); b--)
+    {
+        if (_uart_bauds[b] > max)
+        {
+            continue;
+        }
+
+        // the device switches once the frame is received: the answer to this frame
+        // is lost and its transfer may time out, the read back at the new baud rate decides
+        stpm3x_write_half(dev, STPM3X_REG_US_REG2, _uart_divider(_uart_bauds[b]));
+
+        if ((_uart_set_baudrate(dev, _uart_bauds[b]) == STPM3X_OK) && _uart_check(dev))
+        {
+            DEBUG("%s : UART at %lu bauds\n", DEBUG_FUNC, (unsigned long)_uart_bauds[b]);
+            res = STPM3X_OK;
+        }
+        else
+        {
+            // only a power cycle brings the device back to the reset baud rate
+            dev->shadow[STPM3X_REG_US_REG2 / 2] = initial;
+            _uart_set_baudrate(dev, STPM3X_UART_BAUD_RESET);
+            stpm3x_power_down(dev);
+            stpm3x_time_sleep(STPM3X_T_STARTUP_TYP);
+            stpm3x_resume(dev, &lp);
+        }
+    }
+
+    dev->link.frames = 0;
+    dev->link.errors = 0;
+    dev->link.total_errors = 0;
+    dev->link.total_frames = 0;
+
+    return res;
+}
+
+/*
+ * The device is back at the reset baud rate after a power cycle, then at the
+ * baud rate of the shadow once US_REG2 is restored
+ */
+static void _uart_resync(stpm3x_t *dev, bool reset)
+{
+    const uint16_t divider = dev->shadow[STPM3X_REG_US_REG2 / 2] & STPM3X_MASK_BAUD_RATE;
+    uint32_t baudrate = STPM3X_UART_BAUD_RESET;
+
+    for (unsigned b = 1; !reset && (b < ARRAY_SIZE(_uart_bauds)); b++)
+    {
+        if (divider == _uart_divider(_uart_bauds[b]))
+        {
+            baudrate = _uart_bauds[b];
+        }
+    }
+
+    _uart_set_baudrate(dev, baudrate);
+}
+
+const stpm3x_transport_t stpm3x_transport_uart = {
+    .init = _uart_init,
+    .negotiate = _uart_negotiate,
+    .resync = _uart_resync,
+    .acquire = _uart_acquire,
+    .transfer = _uart_transfer,
+    .release = _uart_release,
+    .crc = _uart_calc_crc8,
+    .scs_level = 1,
+};
+#endif
+
+#if IS_USED(MODULE_STPM3X_TRACE)
+static int _replay_init(stpm3x_t *dev)
+{
+    return (dev->params.trace) ? STPM3X_OK : STPM3X_ERROR;
+}
+
+static void _replay_nop(stpm3x_t *dev)
+{
+    (void)dev;
+}
+
+/*
+ * Next record of the device, skipping ahead to the frame sent on a mismatch
+ */
+static const stpm3x_trace_rec_t *_replay_next(stpm3x_trace_t *trace, uint8_t id, const uint8_t *out)
+{
+    const stpm3x_trace_rec_t *next = NULL;
+    unsigned searched = 0;
+
+    for (size_t pos = trace->pos; (pos < trace->count) && (searched <= STPM3X_TRACE_RESYNC); pos++)
+    {
+        const stpm3x_trace_rec_t *rec = &trace->buf[pos];
+
+        if (rec->id != id)
+        {
+            continue;
+        }
+
+        next = (next) ? next : rec;
+
+        // the CRC byte depends on the bus the trace was recorded on
+        if (memcmp(rec->out, out, STPM3X_FRAME_LEN - 1) == 0)
+        {
+            trace->mismatches += (rec != next);
+            trace->pos = pos + 1;
+            return rec;
+        }
+
+        searched++;
+    }
+
+    if (next)
+    {
+        trace->mismatches++;
+        trace->pos = (next - trace->buf) + 1;
+    }
+
+    return next;
+}
+
+static int _replay_transfer(stpm3x_t *dev, const uint8_t *out, uint8_t *in, size_t frames)
+{
+    stpm3x_trace_t *trace = dev->params.trace;
+    int res = STPM3X_OK;
+
+    for (size_t f = 0; f < frames; f++)
+    {
+        const stpm3x_trace_rec_t *rec = _replay_next(trace, dev->params.trace_id, &out[f * STPM3X_FRAME_LEN]);
+        uint8_t *answer = &in[f * STPM3X_FRAME_LEN];
+
+        if ((rec == NULL) || (rec->flags & STPM3X_TRACE_LOST))
+        {
+            memset(answer, 0, STPM3X_FRAME_LEN);
+            res = STPM3X_ERROR;
+            continue;
+        }
+
+        // answers are sealed again with the CRC of this transport, bad ones stay bad
+        memcpy(answer, rec->in, STPM3X_FRAME_LEN - 1);
+        answer[4] = _spi_calc_crc8(answer) ^ ((rec->flags & STPM3X_TRACE_BAD_CRC) ? 0xff : 0);
+        trace->time = rec->time;
+    }
+
+    return res;
+}
+
+const stpm3x_transport_t stpm3x_transport_replay = {
+    .init = _replay_init,
+    .negotiate = NULL,
+    .acquire = _replay_nop,
+    .transfer = _replay_transfer,
+    .release = _replay_nop,
+    .crc = _spi_calc_crc8,
+    .scs_level = 0,
+};
+#endif
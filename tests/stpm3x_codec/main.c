@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2020 eeproperty Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     tests
+ * @{
+ *
+ * @file
+ * @brief       Host test of the STPM3x record codec
+ *              Round-trips zigzag varints and delta streams over the edge values
+ *              and checks the size of the encoded records.
+ *
+ * @author      Joël Carron <jo.carron@cartondu.ch>
+ *
+ * @}
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "stpm3x_codec.h"
+
+#define CHECK(cond)                                                     \
+    do                                                                  \
+    {                                                                   \
+        if (!(cond))                                                    \
+        {                                                               \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                 \
+        }                                                               \
+    } while (0)
+
+static unsigned failures;
+
+/**
+ * @brief Edge values of the fields
+ */
+static const int32_t _edges[] = {
+    0, 1, -1, 63, -64, 64, -65, INT32_MAX, INT32_MIN, INT32_MAX - 1, INT32_MIN + 1
+};
+
+#define EDGES_NUMOF     (sizeof(_edges) / sizeof(_edges[0]))
+
+/*
+ * Size of the zigzag varint of a value
+ */
+static size_t _varint_size(int32_t value)
+{
+    uint32_t zz = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+    size_t size = 1;
+
+    while (zz >>= 7)
+    {
+        size++;
+    }
+
+    return size;
+}
+
+/*
+ * Encode a record, decode it back and compare, return the encoded size
+ */
+static int _round_trip(stpm3x_codec_t *enc, stpm3x_codec_t *dec, const int32_t *fields, size_t count)
+{
+    uint8_t buf[STPM3X_CODEC_RECORD_MAX];
+    int32_t out[STPM3X_CODEC_FIELDS_MAX];
+    size_t num = 0;
+
+    int len = stpm3x_codec_encode(enc, fields, count, buf, sizeof(buf));
+
+    CHECK(len > 0);
+    CHECK(len <= (int)(1 + (5 * count)));
+    if (len <= 0)
+    {
+        return len;
+    }
+
+    CHECK(stpm3x_codec_decode(dec, buf, len, out, &num) == len);
+    CHECK(num == count);
+    CHECK(memcmp(out, fields, count * sizeof(int32_t)) == 0);
+
+    return len;
+}
+
+/*
+ * Keyframes of one field: the zigzag varint of each edge value, and its exact size
+ */
+static void test_varint(void)
+{
+    stpm3x_codec_t enc, dec;
+
+    // a keyframe at each record
+    stpm3x_codec_init(&enc, 1);
+    stpm3x_codec_init(&dec, 0);
+
+    for (unsigned i = 0; i < EDGES_NUMOF; i++)
+    {
+        int len = _round_trip(&enc, &dec, &_edges[i], 1);
+
+        CHECK(len == (int)(1 + _varint_size(_edges[i])));
+    }
+
+    CHECK(_varint_size(0) == 1);
+    CHECK(_varint_size(-1) == 1);
+    CHECK(_varint_size(1) == 1);
+    CHECK(_varint_size(INT32_MAX) == 5);
+    CHECK(_varint_size(INT32_MIN) == 5);
+}
+
+/*
+ * Delta records between every pair of edge values, the differences wrap around
+ */
+static void test_delta(void)
+{
+    stpm3x_codec_t enc, dec;
+
+    stpm3x_codec_init(&enc, UINT16_MAX);
+    stpm3x_codec_init(&dec, 0);
+
+    for (unsigned i = 0; i < EDGES_NUMOF; i++)
+    {
+        for (unsigned j = 0; j < EDGES_NUMOF; j++)
+        {
+            const int32_t fields[2] = { _edges[i], _edges[j] };
+            const int32_t prev[2] = { enc.prev[0], enc.prev[1] };
+            int first = (enc.fields == 0);
+            int len = _round_trip(&enc, &dec, fields, 2);
+
+            if (!first)
+            {
+                int32_t d0 = (int32_t)((uint32_t)fields[0] - (uint32_t)prev[0]);
+                int32_t d1 = (int32_t)((uint32_t)fields[1] - (uint32_t)prev[1]);
+
+                CHECK(len == (int)(1 + _varint_size(d0) + _varint_size(d1)));
+            }
+        }
+    }
+
+    // INT32_MIN after INT32_MAX is a difference of 1
+    const int32_t max = INT32_MAX;
+    const int32_t min = INT32_MIN;
+
+    _round_trip(&enc, &dec, &max, 1);
+    CHECK(_round_trip(&enc, &dec, &min, 1) == 2);
+}
+
+/*
+ * Records of the maximum number of fields fit in STPM3X_CODEC_RECORD_MAX,
+ * a buffer one byte short is rejected and leaves the encoder unchanged
+ */
+static void test_size(void)
+{
+    stpm3x_codec_t enc, dec;
+    int32_t fields[STPM3X_CODEC_FIELDS_MAX];
+    uint8_t buf[STPM3X_CODEC_RECORD_MAX];
+    int32_t out[STPM3X_CODEC_FIELDS_MAX];
+    size_t num;
+
+    stpm3x_codec_init(&enc, 4);
+    stpm3x_codec_init(&dec, 0);
+
+    for (unsigned i = 0; i < STPM3X_CODEC_FIELDS_MAX; i++)
+    {
+        fields[i] = (i & 1) ? INT32_MIN : INT32_MAX;
+    }
+
+    CHECK(_round_trip(&enc, &dec, fields, STPM3X_CODEC_FIELDS_MAX) == STPM3X_CODEC_RECORD_MAX);
+
+    // the largest delta, from INT32_MAX to INT32_MIN + 1 and back
+    for (unsigned i = 0; i < STPM3X_CODEC_FIELDS_MAX; i++)
+    {
+        fields[i] = (i & 1) ? INT32_MAX : INT32_MIN + 1;
+    }
+
+    stpm3x_codec_t saved = enc;
+    int len = stpm3x_codec_encode(&enc, fields, STPM3X_CODEC_FIELDS_MAX, buf, sizeof(buf));
+
+    CHECK(len > 0);
+    CHECK(len <= (int)STPM3X_CODEC_RECORD_MAX);
+
+    enc = saved;
+    CHECK(stpm3x_codec_encode(&enc, fields, STPM3X_CODEC_FIELDS_MAX, buf, len - 1) == STPM3X_CODEC_ERR_SPACE);
+    CHECK(memcmp(&enc, &saved, sizeof(enc)) == 0);
+
+    CHECK(stpm3x_codec_encode(&enc, fields, STPM3X_CODEC_FIELDS_MAX, buf, len) == len);
+
+    // truncated records are rejected
+    CHECK(stpm3x_codec_decode(&dec, buf, len - 1, out, &num) == STPM3X_CODEC_ERR_SPACE);
+    CHECK(stpm3x_codec_decode(&dec, buf, len, out, &num) == len);
+    CHECK(memcmp(out, fields, sizeof(fields)) == 0);
+
+    // too many fields
+    CHECK(stpm3x_codec_encode(&enc, fields, STPM3X_CODEC_FIELDS_MAX + 1, buf, sizeof(buf)) == STPM3X_CODEC_ERR_FORMAT);
+}
+
+int main(void)
+{
+    test_varint();
+    test_delta();
+    test_size();
+
+    if (failures)
+    {
+        printf("%u checks failed\n", failures);
+        return 1;
+    }
+
+    puts("SUCCESS");
+    return 0;
+}